@@ -9,6 +9,7 @@
 SRCDIR = src
 BLDDIR = build
 BINDIR = $(BLDDIR)/bin
+LIBRDIR = $(BLDDIR)/lib
 OBJDIR = $(BLDDIR)/obj
 DEPDIR = $(BLDDIR)/dep
 
@@ -28,6 +29,7 @@ DEPDIRS += $(SUBDIRS:$(strip $(SRCDIR))/%=$(DEPDIR)/%)
 # Prepare list of directories those shall be created
 ######################################################
 DIRS  = $(BINDIR)
+DIRS += $(LIBRDIR)
 DIRS += $(OBJDIRS)
 DIRS += $(DEPDIRS)
 
@@ -43,10 +45,20 @@ OBJS = $(SRCS:$(strip $(SRCDIR))/%.cc=$(OBJDIR)/%.o)
 LIBS = $(addprefix -l,$(LIBNAMES))
 LIBS := $(call remove-duplicates-libs,$(LIBS))
 
-override CXXFLAGS += -std=c++17
+######################################################
+# Everything except application sources goes to
+# the static and shared library
+######################################################
+APPLOBJS = $(APPLSRCS:%.cc=$(OBJDIR)/%.o)
+LIBROBJS = $(filter-out $(APPLOBJS),$(OBJS))
+LIBR_A = $(LIBRDIR)/lib$(LIBRNAME).a
+LIBR_SO = $(LIBRDIR)/lib$(LIBRNAME).so
+
+override CXXFLAGS += -std=c++20
 override CXXFLAGS += $(addprefix -I,$(SRCDIRS))
 override CXXFLAGS += $(addprefix -I,$(INCLDIRS))
 override CXXFLAGS += -Wall
+override CXXFLAGS += -fPIC
 override CXXFLAGS += -MT $@ -MMD -MP -MF $(DEPDIR)/$*.Td
 
 override LDFLAGS += $(addprefix -L,$(LIBDIRS))
@@ -57,7 +69,10 @@ else
 override CXXFLAGS += -O3
 endif
 
-all : $(APPL)
+all : $(LIBR_A) $(LIBR_SO) $(APPL)
+
+.PHONY : lib
+lib : $(LIBR_A) $(LIBR_SO)
 
 $(DIRS) :
 	mkdir -p $@
@@ -70,7 +85,14 @@ $(OBJS) : $(strip $(OBJDIR))/%.o : $(strip $(SRCDIR))/%.cc $(strip $(DEPDIR))/%.
 	$(CXX) $(CXXFLAGS) -c $< -o $@
 	mv -f $(DEPDIR)/$*.Td $(DEPDIR)/$*.d
 
-$(APPL) : $(OBJS)
+$(LIBR_A) : $(LIBROBJS) | $(DIRS)
+	$(RM) $@
+	$(AR) rcs $@ $^
+
+$(LIBR_SO) : $(LIBROBJS) | $(DIRS)
+	$(CXX) -shared $(LDFLAGS) $^ -o $@ $(LIBS)
+
+$(APPL) : $(APPLOBJS) $(LIBR_A)
 	$(CXX) $(LDFLAGS) $^ -o $@ $(LIBS)
 
 $(strip $(DEPDIR))/%.d: ;
@@ -0,0 +1,390 @@
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "async_connection.h"
+#include "http.h"
+
+namespace http
+{
+    Async_Connection::Async_Connection(Scheduler& s, ipgrogress_ptr_t& pr) noexcept :
+        scheduler(s),
+        progress(pr)
+    {
+
+    }
+
+    Async_Connection::~Async_Connection()
+    {
+        close();
+    }
+
+    Task<> Async_Connection::connect(std::string host, std::uint16_t port)
+    {
+        sockaddr_in sin;
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+
+        /* getaddrinfo blocks, a worker thread must not */
+        co_await scheduler.offload([&]() { sin.sin_addr = resolve_name(host); });
+
+        sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+
+        if (sock < 0)
+        {
+            std::string msg = "Unable to create socket: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        int err = 0;
+
+        if (::connect(sock, (const sockaddr*) &sin, sizeof(sin)) < 0)
+        {
+            err = errno;
+
+            if (err == EINPROGRESS)
+            {
+                if (!co_await scheduler.writable(sock, DOWNLOAD_RCV_TIMEOUT_S * 1000))
+                {
+                    err = ETIMEDOUT;
+                }
+                else
+                {
+                    socklen_t len = sizeof(err);
+                    ::getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+                }
+            }
+        }
+
+        if (err)
+        {
+            close();
+            std::string msg = "Unable to connect to ";
+            msg += host;
+            msg += " (";
+            msg += ::inet_ntoa (sin.sin_addr);
+            msg += ") : ";
+            msg += ::strerror(err);
+            throw Transfer_Error(msg);
+        }
+    }
+
+    Task<> Async_Connection::send_request(std::string request)
+    {
+        size_t sent = 0;
+
+        while (sent < request.length())
+        {
+            auto bytes_sent = ::send(sock, request.c_str() + sent, request.length() - sent, MSG_NOSIGNAL);
+
+            if (bytes_sent < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    if (co_await scheduler.writable(sock, DOWNLOAD_RCV_TIMEOUT_S * 1000))
+                        continue;
+
+                    errno = ETIMEDOUT;
+                }
+
+                std::string msg = "Unable to send request: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            sent += bytes_sent;
+        }
+    }
+
+    Task<Status_Line> Async_Connection::read_status_line()
+    {
+        auto status_line = co_await read_until("\r\n", "check status code");
+        co_return parse_status_line(status_line);
+    }
+
+    Task<header_list_t> Async_Connection::read_headers()
+    {
+        /* no headers at all */
+        while (buffer.length() < 2)
+        {
+            auto buff = scratch_buffer();
+            auto bytes_read = co_await receive(buff, scratch.size(), "retrieve http headers");
+            buffer.append(buff, bytes_read);
+        }
+
+        if (buffer.compare(0, 2, "\r\n") == 0)
+        {
+            buffer.erase(0, 2);
+            co_return header_list_t();
+        }
+
+        auto headers = co_await read_until("\r\n\r\n", "retrieve http headers");
+        headers += "\r\n";
+        co_return parse_headers(headers);
+    }
+
+    Task<> Async_Connection::download(ISink& sink)
+    {
+        auto headers = co_await read_headers();
+
+        auto it = headers.find("transfer-encoding");
+
+        if (it == headers.end())
+        {
+            it = headers.find("content-length");
+
+            if (it == headers.end())
+            {
+                throw std::runtime_error("Invalid headers. Neither Transfer-Encoding nor Content-Length are present.");
+            }
+
+            auto length = std::strtoll(it->second.c_str(), nullptr, 10);
+
+            if (progress)
+            {
+                progress->start();
+                progress->set_total(length);
+            }
+
+            sink.reserve(length);
+            co_await download_content(sink, length);
+        }
+        else
+        {
+            auto encoding = it->second;
+            str_tolower(encoding);
+
+            if (encoding.find("chunked") == std::string::npos)
+            {
+                std::string msg = "Unsupported Transfer-Encoding: ";
+                msg += encoding;
+                throw std::runtime_error(msg);
+            }
+
+            if (progress)
+            {
+                progress->start();
+                progress->set_total(0);
+            }
+
+            co_await download_chunks(sink);
+        }
+
+        if (progress)
+        {
+            progress->stop();
+        }
+
+        sink.finish();
+    }
+
+    Task<size_t> Async_Connection::receive(char* buff, size_t len, const char* what)
+    {
+        while (true)
+        {
+            check_if_canceled();
+
+            auto bytes_read = ::recv(sock, buff, len, 0);
+
+            if (bytes_read > 0)
+                co_return bytes_read;
+
+            if (bytes_read == 0)
+            {
+                std::string msg = "Invalid server response: Unable to ";
+                msg += what;
+                msg += '.';
+                throw Transfer_Error(msg);
+            }
+
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (co_await scheduler.readable(sock, DOWNLOAD_RCV_TIMEOUT_S * 1000))
+                    continue;
+
+                errno = ETIMEDOUT;
+            }
+
+            std::string msg = "Unable to ";
+            msg += what;
+            msg += ": ";
+            msg += strerror(errno);
+            throw Transfer_Error(msg);
+        }
+    }
+
+    Task<std::pmr::string> Async_Connection::read_until(const char* marker, const char* what)
+    {
+        const auto marker_len = std::strlen(marker);
+        std::string::size_type start_pos = 0;
+
+        while (true)
+        {
+            auto marker_pos = buffer.find(marker, start_pos);
+
+            if (marker_pos != std::string::npos)
+            {
+                std::pmr::string line(buffer, 0, marker_pos, &arena);
+                buffer.erase(0, marker_pos + marker_len);
+                co_return line;
+            }
+
+            start_pos = buffer.length() > marker_len ? buffer.length() - marker_len + 1 : 0;
+
+            auto buff = scratch_buffer();
+            auto bytes_read = co_await receive(buff, scratch.size(), what);
+            buffer.append(buff, bytes_read);
+        }
+    }
+
+    void Async_Connection::write(ISink& sink, const char* buff, size_t len)
+    {
+        sink.write(buff, len);
+
+        if (progress)
+        {
+            progress->add_progress(len);
+        }
+    }
+
+    void Async_Connection::close() noexcept
+    {
+        if (sock > 0)
+        {
+            scheduler.release(sock);
+            ::close(sock);
+            sock = -1;
+        }
+
+        if (progress)
+        {
+            progress->stop();
+        }
+
+        /* the receive block is shared with other connections */
+        scratch = Buffer_Pool::Block();
+    }
+
+    char* Async_Connection::scratch_buffer()
+    {
+        if (!scratch.data())
+            scratch = Buffer_Pool::shared().acquire();
+
+        return scratch.data();
+    }
+
+    void Async_Connection::check_if_canceled()
+    {
+        if (progress && progress->is_canceled())
+            throw std::runtime_error("Canceled.");
+    }
+
+    Task<> Async_Connection::download_content(ISink& sink, size_t len)
+    {
+        if (len < buffer.length())
+        {
+            throw std::runtime_error("Unable to get content");
+        }
+
+        write(sink, buffer.data(), buffer.length());
+        len -= buffer.length();
+        buffer.clear();
+
+        auto direct = dynamic_cast<IDirect_Sink*>(&sink);
+
+        while (len)
+        {
+            size_t direct_len = len;
+
+            if (auto p = direct ? direct->acquire(direct_len) : nullptr)
+            {
+                auto bytes_read = co_await receive(p, direct_len, "download content");
+                direct->commit(bytes_read);
+
+                if (progress)
+                {
+                    progress->add_progress(bytes_read);
+                }
+
+                len -= bytes_read;
+                continue;
+            }
+
+            auto buff = scratch_buffer();
+            auto bytes_read = co_await receive(buff, scratch.size(), "download content");
+
+            write(sink, buff, bytes_read);
+            len = len > bytes_read ? len - bytes_read : 0;
+        }
+    }
+
+    Task<> Async_Connection::download_chunks(ISink& sink)
+    {
+        while (true)
+        {
+            auto line = co_await read_until("\r\n", "obtain chunk length");
+
+            /* skip crlf which terminates the previous chunk */
+            if (line.empty())
+                continue;
+
+            size_t len = std::strtoull(line.c_str(), nullptr, 16);
+
+            if (len == 0)
+                break;
+
+            while (len)
+            {
+                if (buffer.empty())
+                {
+                    auto buff = scratch_buffer();
+                    auto bytes_read = co_await receive(buff, scratch.size(), "download chunk");
+                    buffer.append(buff, bytes_read);
+                }
+
+                auto n = std::min(len, buffer.length());
+                write(sink, buffer.data(), n);
+                buffer.erase(0, n);
+                len -= n;
+            }
+        }
+    }
+
+    Task<> async_download(Scheduler& scheduler, std::string url, ISink& sink, ipgrogress_ptr_t& progress)
+    {
+        auto info = Downloader::create_request_info(url);
+
+        if (info.protocol != "http")
+        {
+            std::string msg = "Unsupported protocol: ";
+            msg += info.protocol;
+            throw std::runtime_error(msg);
+        }
+
+        Async_Connection connection(scheduler, progress);
+        co_await connection.connect(info.host, info.port);
+        co_await connection.send_request(Downloader::create_get_request(info));
+
+        auto status = co_await connection.read_status_line();
+
+        if (status.status_code != 200)
+        {
+            auto headers = co_await connection.read_headers();
+            throw Status_Error(status.status_code, unsuccessful_status_message(status, headers));
+        }
+
+        co_await connection.download(sink);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef ASYNC_CONNECTION_H
+#define ASYNC_CONNECTION_H
+
+#include <memory_resource>
+#include <string>
+
+#include "buffers.h"
+#include "iprogress.h"
+#include "isink.h"
+#include "protocol.h"
+#include "scheduler.h"
+#include "task.h"
+
+namespace http
+{
+    class Async_Connection
+    {
+    public:
+        Async_Connection(Scheduler& s, ipgrogress_ptr_t& pr) noexcept;
+        ~Async_Connection();
+
+        Task<> connect(std::string host, std::uint16_t port);
+        Task<> send_request(std::string request);
+        Task<Status_Line> read_status_line();
+        Task<header_list_t> read_headers();
+        Task<> download(ISink& sink);
+
+    private:
+        Task<size_t> receive(char* buff, size_t len, const char* what);
+        Task<std::pmr::string> read_until(const char* marker, const char* what);
+
+        void write(ISink& sink, const char* buff, size_t len);
+        void close() noexcept;
+        char* scratch_buffer();
+        void check_if_canceled();
+
+        Task<> download_content(ISink& sink, size_t len);
+        Task<> download_chunks(ISink& sink);
+
+    private:
+        Scheduler& scheduler;
+        int sock = -1;
+        Arena arena;
+        std::pmr::string buffer { &arena };
+        Buffer_Pool::Block scratch;
+        ipgrogress_ptr_t& progress;
+    };
+
+    Task<> async_download(Scheduler& scheduler, std::string url, ISink& sink, ipgrogress_ptr_t& progress);
+}
+
+#endif // ASYNC_CONNECTION_H
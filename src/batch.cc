@@ -0,0 +1,479 @@
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "batch.h"
+#include "h2.h"
+#include "http.h"
+#include "names.h"
+
+#define BATCH_RETRY_SLICE_MS    100
+
+namespace http
+{
+    manifest_t load_manifest(const std::filesystem::path& path)
+    {
+        std::ifstream in(path);
+
+        if (!in.is_open())
+        {
+            std::string msg = "Unable to open manifest '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+
+        manifest_t manifest;
+        std::string line;
+        size_t line_no = 0;
+
+        while (std::getline(in, line))
+        {
+            ++line_no;
+
+            std::istringstream fields(line);
+            Manifest_Entry entry;
+
+            if (!(fields >> entry.url) || entry.url[0] == '#')
+                continue;
+
+            std::string size, priority, destination;
+            fields >> size >> priority >> destination;
+
+            try
+            {
+                if (!size.empty() && size != "-")
+                    entry.size = std::stoull(size);
+
+                if (!priority.empty() && priority != "-")
+                    entry.priority = std::stoi(priority);
+            }
+            catch (const std::logic_error&)
+            {
+                std::string msg = "Invalid manifest entry at line ";
+                msg += std::to_string(line_no);
+                msg += ": ";
+                msg += line;
+                throw std::invalid_argument(msg);
+            }
+
+            if (!destination.empty() && destination != "-")
+                entry.destination = destination;
+
+            manifest.push_back(std::move(entry));
+        }
+
+        return manifest;
+    }
+
+    Batch_Scheduler::Batch_Scheduler(const Batch_Options& opts) :
+        options(opts)
+    {
+        options.global_limit = std::max<size_t>(options.global_limit, 1);
+        options.per_host_limit = std::max<size_t>(options.per_host_limit, 1);
+    }
+
+    Batch_Summary Batch_Scheduler::run(manifest_t manifest)
+    {
+        auto started = std::chrono::steady_clock::now();
+
+        Batch_Summary summary;
+        summary.total = manifest.size();
+
+        std::vector<size_t> indices(manifest.size());
+        std::iota(indices.begin(), indices.end(), 0);
+
+        /* sizes are needed to put the longest transfers first */
+        /* h2c servers do not answer HTTP/1.1 HEAD */
+        if (options.probe && !options.h2c && options.order == Batch_Options::Order::largest_first)
+        {
+            std::vector<size_t> unknown;
+            std::copy_if(indices.begin(), indices.end(), std::back_inserter(unknown),
+                         [&](size_t i) { return manifest[i].size == 0; });
+
+            dispatch(manifest, unknown, [this](Manifest_Entry& entry) { probe(entry); });
+        }
+
+        order(manifest, indices);
+
+        if (options.h2c)
+        {
+            fetch_h2c(manifest, indices, summary);
+            summary.elapsed = std::chrono::steady_clock::now() - started;
+            return summary;
+        }
+
+        std::shared_ptr<Journal> journal;
+
+        if (!options.journal.empty())
+            journal = std::make_shared<Journal>(options.journal);
+
+        std::mutex mutex;
+
+        dispatch(manifest, indices, [&](Manifest_Entry& entry)
+        {
+            try
+            {
+                if (options.cancel.is_canceled())
+                    throw std::runtime_error("Canceled.");
+
+                Downloader downloader(nullptr);
+                downloader.set_cancel_token(options.cancel);
+                downloader.set_output_mode(options.output_mode);
+                downloader.set_retry_policy(options.retry);
+                downloader.set_journal(journal);
+
+                auto directory = options.directory;
+
+                if (entry.destination.has_parent_path())
+                    directory /= entry.destination.parent_path();
+
+                auto path = downloader.dowload(entry.url, directory, entry.destination.filename(), options.rewrite);
+
+                std::error_code ec;
+                auto size = std::filesystem::file_size(path, ec);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ++summary.succeeded;
+                summary.bytes += ec ? 0 : size;
+            }
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                summary.failures.push_back({ entry.url, e.what() });
+            }
+        });
+
+        summary.elapsed = std::chrono::steady_clock::now() - started;
+
+        return summary;
+    }
+
+    template<typename Work>
+    void Batch_Scheduler::dispatch(manifest_t& manifest, const std::vector<size_t>& indices, Work work)
+    {
+        if (indices.empty())
+            return;
+
+        std::vector<std::string> hosts;
+        hosts.reserve(indices.size());
+
+        for (auto i : indices)
+            hosts.push_back(host_key(manifest[i].url));
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<bool> taken(indices.size(), false);
+        std::unordered_map<std::string, size_t> active;
+        size_t first = 0;   /* all before it are taken */
+
+        auto worker = [&]()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (true)
+            {
+                while (first < taken.size() && taken[first])
+                    ++first;
+
+                if (first == taken.size())
+                    return;
+
+                /* the first entry in order whose host is below its cap */
+                size_t k = first;
+
+                while (k < taken.size() && (taken[k] || active[hosts[k]] >= options.per_host_limit))
+                    ++k;
+
+                if (k == taken.size())
+                {
+                    cv.wait(lock);
+                    continue;
+                }
+
+                taken[k] = true;
+                ++active[hosts[k]];
+                lock.unlock();
+
+                work(manifest[indices[k]]);
+
+                lock.lock();
+                --active[hosts[k]];
+                cv.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        auto count = std::min(options.global_limit, indices.size());
+
+        for (size_t i = 0; i < count; ++i)
+            workers.emplace_back(worker);
+
+        for (auto& w : workers)
+            w.join();
+    }
+
+    void Batch_Scheduler::probe(Manifest_Entry& entry)
+    {
+        try
+        {
+            auto info = Downloader::create_request_info(entry.url);
+
+            if (info.protocol != "http" && info.protocol != "https")
+                return;
+
+            ipgrogress_ptr_t none;
+            Connection connection(none);
+            connection.set_secure(info.protocol == "https");
+            connection.set_receive_timeout(options.retry.stall_timeout);
+            connection.set_cancel_token(options.cancel);
+            connection.connect(info.host, info.port);
+            connection.send_request(Downloader::create_head_request(info));
+
+            auto status = connection.retrieve_http_status_line();
+            auto headers = connection.retrieve_headers();
+            auto it = headers.find("content-length");
+
+            if (status.status_code == 200 && it != headers.end())
+                entry.size = std::strtoull(it->second.c_str(), nullptr, 10);
+        }
+        catch (const std::exception&)
+        {
+            /* the download reports the problem */
+        }
+    }
+
+    void Batch_Scheduler::fetch_h2c(manifest_t& manifest, const std::vector<size_t>& indices, Batch_Summary& summary)
+    {
+        /* entries of one host are multiplexed over one connection, hosts go in parallel */
+        std::vector<std::string> hosts;
+        std::unordered_map<std::string, std::vector<size_t>> groups;
+
+        for (auto i : indices)
+        {
+            auto key = host_key(manifest[i].url);
+            auto& group = groups[key];
+
+            if (group.empty())
+                hosts.push_back(key);
+
+            group.push_back(i);
+        }
+
+        std::mutex mutex;
+        size_t next = 0;
+
+        auto worker = [&]()
+        {
+            while (true)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                if (next == hosts.size())
+                    return;
+
+                const auto& group = groups[hosts[next++]];
+                lock.unlock();
+
+                fetch_host(manifest, group, summary, mutex);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        auto count = std::min(options.global_limit, hosts.size());
+
+        for (size_t i = 0; i < count; ++i)
+            workers.emplace_back(worker);
+
+        for (auto& w : workers)
+            w.join();
+    }
+
+    void Batch_Scheduler::fetch_host(manifest_t& manifest, const std::vector<size_t>& group, Batch_Summary& summary, std::mutex& mutex)
+    {
+        struct Item
+        {
+            const Manifest_Entry* entry;
+            Downloader::Request_Info info;
+            std::filesystem::path path;
+            isink_ptr_t sink;
+        };
+
+        auto failed = [&](const Manifest_Entry& entry, const std::string& error)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            summary.failures.push_back({ entry.url, error });
+        };
+
+        std::vector<Item> pending;
+
+        for (auto i : group)
+        {
+            const auto& entry = manifest[i];
+
+            try
+            {
+                Item item;
+                item.entry = &entry;
+                item.info = Downloader::create_request_info(entry.url);
+
+                if (item.info.protocol != "http" && !item.info.protocol.empty())
+                {
+                    std::string msg = "Unsupported protocol for h2c: ";
+                    msg += item.info.protocol;
+                    throw std::invalid_argument(msg);
+                }
+
+                auto directory = options.directory.empty() ? "." : options.directory;
+
+                if (entry.destination.has_parent_path())
+                    directory /= entry.destination.parent_path();
+
+                auto name = entry.destination.has_filename() ? entry.destination.filename() : std::filesystem::path(item.info.file_name);
+
+                if (name.empty())
+                    throw std::invalid_argument("Invalid URL: file name is missing.");
+
+                item.path = options.rewrite ? directory / name : Name_Allocator::shared().claim(directory, name);
+
+                pending.push_back(std::move(item));
+            }
+            catch (const std::exception& e)
+            {
+                failed(entry, e.what());
+            }
+        }
+
+        for (unsigned attempt = 1; !pending.empty(); ++attempt)
+        {
+            if (options.cancel.is_canceled())
+            {
+                for (const auto& item : pending)
+                    failed(*item.entry, "Canceled.");
+
+                return;
+            }
+
+            std::vector<H2_Request> requests(pending.size());
+
+            try
+            {
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    pending[i].sink = create_file_sink(pending[i].path, options.output_mode);
+                    requests[i].path = "/" + pending[i].info.url;
+                    requests[i].sink = pending[i].sink.get();
+                }
+
+                H2_Connection connection;
+                connection.set_receive_timeout(options.retry.stall_timeout);
+                connection.set_cancel_token(options.cancel);
+                connection.connect(pending.front().info.host, pending.front().info.port);
+                connection.fetch(requests);
+            }
+            catch (const std::exception& e)
+            {
+                for (auto& request : requests)
+                {
+                    if (request.error.empty() && !request.status_code)
+                    {
+                        request.error = e.what();
+                        request.retryable = true;
+                    }
+                }
+            }
+
+            std::vector<Item> retry;
+
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                auto& item = pending[i];
+                const auto& request = requests[i];
+                item.sink.reset();
+
+                if (request.error.empty())
+                {
+                    std::error_code ec;
+                    auto size = std::filesystem::file_size(item.path, ec);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++summary.succeeded;
+                    summary.bytes += ec ? 0 : size;
+                }
+                else if (attempt < options.retry.max_attempts &&
+                         (request.retryable || request.status_code == 0 || Retry_Policy::is_retryable_status(request.status_code)))
+                {
+                    retry.push_back(std::move(item));
+                }
+                else
+                {
+                    failed(*item.entry, request.error);
+                }
+            }
+
+            pending.swap(retry);
+
+            if (!pending.empty())
+                wait_before_retry(attempt);
+        }
+    }
+
+    void Batch_Scheduler::wait_before_retry(unsigned attempt) const
+    {
+        auto deadline = std::chrono::steady_clock::now() + options.retry.delay(attempt);
+
+        /* short slices, so cancellation is noticed soon */
+        while (!options.cancel.is_canceled() && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - std::chrono::steady_clock::now(),
+                                                                                     std::chrono::milliseconds(BATCH_RETRY_SLICE_MS)));
+    }
+
+    void Batch_Scheduler::order(const manifest_t& manifest, std::vector<size_t>& indices) const
+    {
+        switch (options.order)
+        {
+            case Batch_Options::Order::largest_first:
+                std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b)
+                {
+                    if (manifest[a].priority != manifest[b].priority)
+                        return manifest[a].priority > manifest[b].priority;
+
+                    return manifest[a].size > manifest[b].size;
+                });
+                break;
+
+            case Batch_Options::Order::priority:
+                std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b)
+                {
+                    return manifest[a].priority > manifest[b].priority;
+                });
+                break;
+
+            case Batch_Options::Order::manifest:
+            default:
+                break;
+        }
+    }
+
+    std::string Batch_Scheduler::host_key(const std::string& url)
+    {
+        try
+        {
+            auto info = Downloader::create_request_info(url);
+            std::string key = info.host;
+            key += ':';
+            key += std::to_string(info.port);
+            return key;
+        }
+        catch (const std::exception&)
+        {
+            return url;
+        }
+    }
+}
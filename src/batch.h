@@ -0,0 +1,96 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cancel.h"
+#include "retry.h"
+#include "sinks.h"
+
+/*
+ * Batch downloads from a manifest.
+ *
+ * Manifest is a text file, one entry per line:
+ *     URL [size [priority [destination]]]
+ * Empty lines and lines starting with '#' are ignored, '-' skips a field.
+*/
+
+namespace http
+{
+    struct Manifest_Entry
+    {
+        std::string url;
+        size_t size = 0;                    /* 0 - unknown, learned by HEAD */
+        int priority = 0;                   /* higher goes first */
+        std::filesystem::path destination;  /* empty - derived from URL */
+    };
+
+    using manifest_t = std::vector<Manifest_Entry>;
+
+    manifest_t load_manifest(const std::filesystem::path& path);
+
+    struct Batch_Options
+    {
+        enum class Order
+        {
+            manifest,
+            largest_first,
+            priority
+        };
+
+        Order order = Order::largest_first;
+        bool probe = true;                  /* HEAD for entries of unknown size */
+        size_t global_limit = 8;            /* connections at once */
+        size_t per_host_limit = 2;
+        std::filesystem::path directory;
+        bool rewrite = false;
+        Output_Mode output_mode = Output_Mode::stream;
+        Retry_Policy retry;
+        std::filesystem::path journal;      /* empty - no restart after a crash */
+        bool h2c = false;                   /* HTTP/2 with prior knowledge, one connection per host */
+        Cancel_Token cancel;                /* stops the batch, entries not done fail */
+    };
+
+    struct Batch_Summary
+    {
+        struct Failure
+        {
+            std::string url;
+            std::string error;
+        };
+
+        size_t total = 0;
+        size_t succeeded = 0;
+        size_t bytes = 0;
+        std::chrono::steady_clock::duration elapsed {};
+        std::vector<Failure> failures;
+    };
+
+    class Batch_Scheduler
+    {
+    public:
+        explicit Batch_Scheduler(const Batch_Options& opts);
+
+        Batch_Summary run(manifest_t manifest);
+
+    private:
+        template<typename Work>
+        void dispatch(manifest_t& manifest, const std::vector<size_t>& order, Work work);
+
+        void probe(Manifest_Entry& entry);
+        void wait_before_retry(unsigned attempt) const;
+        void fetch_h2c(manifest_t& manifest, const std::vector<size_t>& indices, Batch_Summary& summary);
+        void fetch_host(manifest_t& manifest, const std::vector<size_t>& group, Batch_Summary& summary, std::mutex& mutex);
+        void order(const manifest_t& manifest, std::vector<size_t>& indices) const;
+        static std::string host_key(const std::string& url);
+
+    private:
+        Batch_Options options;
+    };
+}
+
+#endif // BATCH_H
@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "buffers.h"
+
+#define BUFFER_POOL_BLOCK_SIZE  (16 * 1024)
+#define BUFFER_POOL_SLAB_BLOCKS 64
+#define BUFFER_POOL_ALIGNMENT   64
+
+namespace http
+{
+    Buffer_Pool::Block::Block(Block&& other) noexcept :
+        pool(other.pool),
+        ptr(other.ptr)
+    {
+        other.pool = nullptr;
+        other.ptr = nullptr;
+    }
+
+    Buffer_Pool::Block& Buffer_Pool::Block::operator=(Block&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (ptr)
+                pool->give_back(ptr);
+
+            pool = other.pool;
+            ptr = other.ptr;
+            other.pool = nullptr;
+            other.ptr = nullptr;
+        }
+
+        return *this;
+    }
+
+    Buffer_Pool::Block::~Block()
+    {
+        if (ptr)
+            pool->give_back(ptr);
+    }
+
+    Buffer_Pool::Buffer_Pool(size_t bs, size_t sb) :
+        /* whole cache lines, so neighbouring blocks never share one */
+        block_size((bs + BUFFER_POOL_ALIGNMENT - 1) / BUFFER_POOL_ALIGNMENT * BUFFER_POOL_ALIGNMENT),
+        slab_blocks(sb ? sb : 1)
+    {
+
+    }
+
+    Buffer_Pool::~Buffer_Pool()
+    {
+        for (auto slab : slabs)
+            std::free(slab);
+    }
+
+    Buffer_Pool::Block Buffer_Pool::acquire()
+    {
+        return Block(this, take());
+    }
+
+    Buffer_Pool& Buffer_Pool::shared()
+    {
+        static Buffer_Pool pool(BUFFER_POOL_BLOCK_SIZE, BUFFER_POOL_SLAB_BLOCKS);
+        return pool;
+    }
+
+    char* Buffer_Pool::take()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (free_blocks.empty())
+        {
+            auto slab = static_cast<char*>(std::aligned_alloc(BUFFER_POOL_ALIGNMENT, block_size * slab_blocks));
+
+            if (!slab)
+                throw std::bad_alloc();
+
+            slabs.push_back(slab);
+            free_blocks.reserve(slabs.size() * slab_blocks);
+
+            /* hand out low addresses first */
+            for (size_t i = slab_blocks; i > 0; --i)
+                free_blocks.push_back(slab + (i - 1) * block_size);
+        }
+
+        auto block = free_blocks.back();
+        free_blocks.pop_back();
+        return block;
+    }
+
+    void Buffer_Pool::give_back(char* block) noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        /* capacity covers every block ever carved, so this never allocates */
+        free_blocks.push_back(block);
+    }
+
+    Arena::Arena(Buffer_Pool& p) noexcept :
+        pool(p)
+    {
+
+    }
+
+    Arena::~Arena()
+    {
+        reset();
+    }
+
+    void Arena::reset() noexcept
+    {
+        for (auto block : blocks)
+            pool.give_back(block);
+
+        blocks.clear();
+        oversized.release();
+        cursor = nullptr;
+        left = 0;
+    }
+
+    void* Arena::do_allocate(size_t bytes, size_t alignment)
+    {
+        if (bytes + alignment > pool.get_block_size())
+            return oversized.allocate(bytes, alignment);
+
+        auto pad = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+
+        if (!cursor || pad + bytes > left)
+        {
+            blocks.reserve(blocks.size() + 1);
+            cursor = pool.take();
+            blocks.push_back(cursor);
+            left = pool.get_block_size();
+            pad = 0;
+        }
+
+        auto p = cursor + pad;
+        cursor += pad + bytes;
+        left -= pad + bytes;
+        return p;
+    }
+
+    void Arena::do_deallocate(void*, size_t, size_t)
+    {
+        /* released all at once by reset */
+    }
+
+    bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+    {
+        return this == &other;
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+namespace http
+{
+    /*
+     * Fixed-size, cache-line aligned receive blocks carved out of large slabs.
+     * Blocks are shared by all connections and are held only while a receive
+     * loop runs, so memory follows the bytes in flight, not the connection count.
+    */
+    class Buffer_Pool
+    {
+    public:
+        class Block
+        {
+        public:
+            Block() noexcept = default;
+            Block(Block&& other) noexcept;
+            Block& operator=(Block&& other) noexcept;
+            ~Block();
+
+            char* data() const noexcept { return ptr; }
+            size_t size() const noexcept { return pool ? pool->block_size : 0; }
+
+        private:
+            friend class Buffer_Pool;
+            Block(Buffer_Pool* p, char* b) noexcept : pool(p), ptr(b) {}
+
+        private:
+            Buffer_Pool* pool = nullptr;
+            char* ptr = nullptr;
+        };
+
+    public:
+        Buffer_Pool(size_t block_size, size_t slab_blocks);
+        ~Buffer_Pool();
+
+        Buffer_Pool(const Buffer_Pool&) = delete;
+        Buffer_Pool& operator=(const Buffer_Pool&) = delete;
+
+        Block acquire();
+        size_t get_block_size() const noexcept { return block_size; }
+
+        static Buffer_Pool& shared();
+
+    private:
+        friend class Arena;
+
+        char* take();
+        void give_back(char* block) noexcept;
+
+    private:
+        const size_t block_size;
+        const size_t slab_blocks;
+        std::mutex mutex;
+        std::vector<char*> free_blocks;
+        std::vector<void*> slabs;
+    };
+
+    /*
+     * Bump allocator for the parse-time state of one request: the receive
+     * backlog and the raw status line and headers. Memory comes in pool blocks
+     * and all of it goes back at once on reset, nothing is freed piecemeal.
+    */
+    class Arena : public std::pmr::memory_resource
+    {
+    public:
+        explicit Arena(Buffer_Pool& pool = Buffer_Pool::shared()) noexcept;
+        ~Arena() override;
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void reset() noexcept;
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    private:
+        Buffer_Pool& pool;
+        std::vector<char*> blocks;
+        std::pmr::monotonic_buffer_resource oversized { std::pmr::new_delete_resource() };
+        char* cursor = nullptr;
+        size_t left = 0;
+    };
+}
+
+#endif // BUFFERS_H
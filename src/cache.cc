@@ -0,0 +1,210 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <openssl/evp.h>
+
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "cache.h"
+
+#define CACHE_INDEX_FILE_NAME   "index"
+
+namespace http
+{
+    Http_Cache::Http_Cache(const std::filesystem::path& d) :
+        dir(d)
+    {
+        std::filesystem::create_directories(dir);
+        load();
+    }
+
+    std::optional<Http_Cache::Entry> Http_Cache::find(const std::string& url)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(url);
+
+        if (it == index.end() || !std::filesystem::exists(it->second.content_path))
+            return std::nullopt;
+
+        return it->second;
+    }
+
+    bool Http_Cache::restore(const Entry& entry, const std::filesystem::path& to)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        /* another process may have stored a newer version meanwhile */
+        load();
+
+        auto it = index.find(entry.url);
+
+        if (it == index.end() ||
+            it->second.url != entry.url ||
+            it->second.etag != entry.etag ||
+            it->second.last_modified != entry.last_modified ||
+            it->second.content_path != entry.content_path ||
+            !std::filesystem::exists(entry.content_path))
+            return false;
+
+        materialize(entry.content_path, to);
+        return true;
+    }
+
+    void Http_Cache::store(const std::string& url,
+                           const std::string& etag,
+                           const std::string& last_modified,
+                           const std::filesystem::path& file)
+    {
+        if (etag.empty() && last_modified.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Entry entry{ url, etag, last_modified, content_path(url) };
+        materialize(file, entry.content_path);
+
+        /* pick up entries stored by other processes meanwhile */
+        load();
+
+        /* content stored under an older naming scheme */
+        auto it = index.find(url);
+
+        if (it != index.end() && it->second.content_path != entry.content_path)
+        {
+            std::error_code ec;
+            std::filesystem::remove(it->second.content_path, ec);
+        }
+
+        index[url] = std::move(entry);
+        save();
+    }
+
+    std::string Http_Cache::conditional_headers(const Entry& entry)
+    {
+        std::string headers;
+
+        if (!entry.etag.empty())
+        {
+            headers += "If-None-Match: ";
+            headers += entry.etag;
+            headers += "\r\n";
+        }
+
+        if (!entry.last_modified.empty())
+        {
+            headers += "If-Modified-Since: ";
+            headers += entry.last_modified;
+            headers += "\r\n";
+        }
+
+        return headers;
+    }
+
+    void Http_Cache::materialize(const std::filesystem::path& from, const std::filesystem::path& to)
+    {
+        std::filesystem::remove(to);
+
+        /* reflink shares blocks copy-on-write where file system allows it */
+        int src = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (src >= 0)
+        {
+            int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+            if (dst >= 0)
+            {
+                auto cloned = ::ioctl(dst, FICLONE, src) == 0;
+                ::close(dst);
+                ::close(src);
+
+                if (cloned)
+                    return;
+
+                std::filesystem::remove(to);
+            }
+            else
+            {
+                ::close(src);
+            }
+        }
+
+        /* never a hard link: rewriting the user's file in place would corrupt the cached one */
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    }
+
+    void Http_Cache::load()
+    {
+        std::ifstream in(dir / CACHE_INDEX_FILE_NAME);
+        std::string line;
+
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string url;
+            Entry entry;
+            std::string name;
+
+            if (std::getline(fields, url, '\t') &&
+                std::getline(fields, entry.etag, '\t') &&
+                std::getline(fields, entry.last_modified, '\t') &&
+                std::getline(fields, name))
+            {
+                entry.url = url;
+                entry.content_path = dir / name;
+                index[url] = std::move(entry);
+            }
+        }
+    }
+
+    void Http_Cache::save()
+    {
+        auto tmp = dir / (CACHE_INDEX_FILE_NAME "." + std::to_string(::getpid()));
+
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+
+            for (const auto& [url, entry] : index)
+            {
+                out << url << '\t'
+                    << entry.etag << '\t'
+                    << entry.last_modified << '\t'
+                    << entry.content_path.filename().string() << '\n';
+            }
+
+            if (!out)
+            {
+                std::string msg = "Unable to write cache index in '";
+                msg += dir.string();
+                msg += "'.";
+                throw std::runtime_error(msg);
+            }
+        }
+
+        std::filesystem::rename(tmp, dir / CACHE_INDEX_FILE_NAME);
+    }
+
+    std::filesystem::path Http_Cache::content_path(const std::string& url) const
+    {
+        /* a collision of names would serve one URL's content for another */
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_len = 0;
+
+        if (!::EVP_Digest(url.data(), url.size(), digest, &digest_len, ::EVP_sha256(), nullptr))
+            throw std::runtime_error("Unable to compute cache file name.");
+
+        std::ostringstream name;
+        name << std::hex << std::setfill('0');
+
+        for (unsigned int i = 0; i < digest_len; ++i)
+            name << std::setw(2) << static_cast<unsigned>(digest[i]);
+
+        return dir / name.str();
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/*
+ * On-disk cache of downloaded files with their validators.
+ *
+ * RFC 7232 - "Hypertext Transfer Protocol (HTTP/1.1): Conditional Requests"
+ * https://www.ietf.org/rfc/rfc7232.html
+*/
+
+namespace http
+{
+    class Http_Cache
+    {
+    public:
+        struct Entry
+        {
+            std::string url;
+            std::string etag;
+            std::string last_modified;
+            std::filesystem::path content_path;
+        };
+
+    public:
+        explicit Http_Cache(const std::filesystem::path& dir);
+
+        std::optional<Entry> find(const std::string& url);
+        void store(const std::string& url,
+                   const std::string& etag,
+                   const std::string& last_modified,
+                   const std::filesystem::path& file);
+
+        /* copies the content if the index still holds this very entry */
+        bool restore(const Entry& entry, const std::filesystem::path& to);
+
+        static std::string conditional_headers(const Entry& entry);
+        static void materialize(const std::filesystem::path& from, const std::filesystem::path& to);
+
+    private:
+        void load();
+        void save();
+        std::filesystem::path content_path(const std::string& url) const;
+
+    private:
+        std::filesystem::path dir;
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> index;
+    };
+}
+
+#endif // CACHE_H
@@ -0,0 +1,35 @@
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <atomic>
+#include <memory>
+
+namespace http
+{
+    /* shared cancellation flag, copies refer to the same flag */
+    class Cancel_Token
+    {
+    public:
+        Cancel_Token() :
+            flag(std::make_shared<std::atomic_bool>(false))
+        {
+
+        }
+
+        /* async-signal-safe */
+        void cancel() const noexcept
+        {
+            flag->store(true);
+        }
+
+        bool is_canceled() const noexcept
+        {
+            return flag->load();
+        }
+
+    private:
+        std::shared_ptr<std::atomic_bool> flag;
+    };
+}
+
+#endif // CANCEL_H
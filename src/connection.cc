@@ -0,0 +1,779 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "connection.h"
+#include "pool.h"
+
+#define RCV_SMALL_BUFF_SIZE     64
+#define RCV_LARGE_BUFF_SIZE     1024
+#define CONNECT_POLL_INTERVAL_MS 100
+
+namespace http
+{
+    Connection::Connection(ipgrogress_ptr_t& pr) noexcept :
+        abort_fd(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        progress(pr)
+    {
+
+    }
+
+    Connection::~Connection()
+    {
+        close();
+
+        if (abort_fd >= 0)
+            ::close(abort_fd);
+    }
+
+    void Connection::connect(const std::string& host, uint16_t port)
+    {
+        if (auto idle = Connection_Pool::shared().take(Connection_Pool::key(host, port, secure)))
+        {
+            sock = idle->sock;
+            tls = std::move(idle->tls);
+            peer_addr = idle->peer;
+            pool_key = Connection_Pool::key(host, port, secure);
+            reused = true;
+            Stats::shared().socket_opened();
+
+            apply_receive_timeout();
+            return;
+        }
+
+        connect(host, resolve_name(host), port);
+    }
+
+    void Connection::connect(const std::string& host, in_addr addr, uint16_t port)
+    {
+        sockaddr_in sin;
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr = addr;
+        peer_addr = addr;
+
+        sock = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+
+        if (sock < 0)
+        {
+            std::string msg = "Unable to create socket: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        Stats::shared().socket_opened();
+        apply_receive_timeout();
+
+        /* non-blocking, so a timeout or abort() can interrupt it */
+        int err = ::connect(sock, (const sockaddr*) &sin, sizeof(sin)) < 0 ? errno : 0;
+
+        if (err == EINPROGRESS)
+        {
+            try
+            {
+                err = wait_until_connected();
+            }
+            catch (...)
+            {
+                close();
+                throw;
+            }
+        }
+
+        if (err == 0 && ::fcntl(sock, F_SETFL, ::fcntl(sock, F_GETFL) & ~O_NONBLOCK) < 0)
+            err = errno;
+
+        if (err != 0)
+        {
+            close();
+            std::string msg = "Unable to connect to ";
+            msg += host;
+            msg += " (";
+            msg += ::inet_ntoa (sin.sin_addr);
+            msg += ") : ";
+            msg += ::strerror(err);
+            throw Transfer_Error(msg);
+        }
+
+        if (secure)
+        {
+            tls = std::make_unique<Tls_Session>(Tls_Context::shared(), sock, host, port);
+            Stats::shared().tls_established(tls->resumed(), tls->kernel_offload());
+        }
+
+        pool_key = Connection_Pool::key(host, port, secure);
+    }
+
+    size_t Connection::read(char* buff, size_t len)
+    {
+        /* what came along with the headers goes first */
+        if (!buffer.empty())
+        {
+            auto n = std::min(len, buffer.length());
+            std::memcpy(buff, buffer.data(), n);
+            buffer.erase(0, n);
+            return n;
+        }
+
+        while (true)
+        {
+            check_if_canceled();
+
+            auto bytes_read = receive(buff, len);
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to receive data: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Connection is closed by server.");
+            }
+
+            return bytes_read;
+        }
+    }
+
+    void Connection::set_receive_timeout(std::chrono::seconds timeout) noexcept
+    {
+        receive_timeout = timeout;
+    }
+
+    void Connection::set_speed_limit(size_t limit, std::chrono::seconds window) noexcept
+    {
+        speed_monitor = Speed_Monitor(limit, window);
+    }
+
+    void Connection::set_cancel_token(const Cancel_Token& token) noexcept
+    {
+        cancel_token = token;
+    }
+
+    void Connection::set_transfer_stats(Transfer_Stats* stats) noexcept
+    {
+        transfer_stats = stats;
+    }
+
+    void Connection::set_secure(bool s) noexcept
+    {
+        secure = s;
+    }
+
+    bool Connection::is_secure() const noexcept
+    {
+        return secure;
+    }
+
+    bool Connection::is_resumed() const noexcept
+    {
+        return tls && tls->resumed();
+    }
+
+    bool Connection::is_reused() const noexcept
+    {
+        return reused;
+    }
+
+    size_t Connection::received() const noexcept
+    {
+        return content_received;
+    }
+
+    in_addr Connection::peer() const noexcept
+    {
+        return peer_addr;
+    }
+
+    void Connection::abort() noexcept
+    {
+        aborted = true;
+
+        /* wakes up connect in progress */
+        if (abort_fd >= 0)
+        {
+            std::uint64_t one = 1;
+
+            if (::write(abort_fd, &one, sizeof(one)) < 0)
+            {
+                /* the counter is already set */
+            }
+        }
+
+        /* wakes up blocked recv */
+        int s = sock;
+
+        if (s > 0)
+            ::shutdown(s, SHUT_RDWR);
+    }
+
+    void Connection::recycle(const Status_Line& status, const header_list_t& headers) noexcept
+    {
+        /* only a response delimited by Content-Length is known to be read completely */
+        if (sock < 0 || aborted || !buffer.empty() ||
+            status.protocol_version != "HTTP/1.1" ||
+            headers.count("transfer-encoding") ||
+            !headers.count("content-length"))
+            return;
+
+        auto it = headers.find("connection");
+
+        if (it != headers.end())
+        {
+            auto value = it->second;
+            str_tolower(value);
+
+            if (value.find("close") != std::string::npos)
+                return;
+        }
+
+        Connection_Pool::Idle idle;
+        idle.sock = sock;
+        idle.tls = std::move(tls);
+        idle.peer = peer_addr;
+
+        Connection_Pool::shared().put(pool_key, std::move(idle));
+        sock = -1;
+        Stats::shared().socket_closed();
+
+        release_buffers();
+    }
+
+    void Connection::send_request(const std::string& request) const
+    {
+        auto bytes_sent = tls ? tls->write(request.c_str(), request.length())
+                              : ::send(sock, request.c_str(), request.length(), MSG_NOSIGNAL);
+
+        if ((unsigned int) bytes_sent < request.length())
+        {
+            std::string msg = "Unable to send request: ";
+            msg += strerror(errno);
+            throw Transfer_Error(msg);
+        }
+    }
+
+    Status_Line Connection::retrieve_http_status_line()
+    {
+        char buff[RCV_SMALL_BUFF_SIZE];
+        bool cr_found = false;
+        bool lf_found = false;
+        std::pmr::string status_line(&arena);
+        ssize_t bytes_read;
+        ssize_t i = 0;
+
+        while (!(cr_found && lf_found))
+        {
+            check_if_canceled();
+
+            bytes_read = receive(buff, sizeof(buff));
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to check status code: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Invalid server response: Unable to retrieve status line");
+            }
+
+            i = 0;
+
+            if (cr_found)
+            {
+                if (buff[i] == '\n')
+                {
+                    lf_found = true;
+                    ++i;
+                }
+                else
+                {
+                    throw std::domain_error("Invalid server response");
+                }
+            }
+            else
+            {
+                while (i < bytes_read)
+                {
+                    if (buff[i] == '\r')
+                    {
+                        cr_found = true;
+
+                        if (++i < RCV_SMALL_BUFF_SIZE)
+                        {
+                            if (buff[i] == '\n')
+                            {
+                                lf_found = true;
+                                ++i;
+                                break;
+                            }
+                            else
+                            {
+                                throw std::domain_error("Invalid server response");
+                            }
+                        }
+                    }
+
+                    ++i;
+                }
+            }
+
+            size_t end = i;
+
+            if (cr_found)
+                --end;
+
+            if (lf_found)
+                --end;
+
+            status_line.append(buff, end);
+        }
+
+        buffer.append(&buff[i], bytes_read - i);
+
+        return parse_status_line(status_line);
+    }
+
+    header_list_t Connection::retrieve_headers()
+    {
+        const char* marker = "\r\n\r\n";
+        const auto marker_len = std::strlen(marker);
+
+        std::string::size_type start_pos = 0;
+        std::string::size_type marker_pos = std::string::npos;
+
+        while (true)
+        {
+            check_if_canceled();
+
+            marker_pos = buffer.find(marker, start_pos);
+
+            if (marker_pos != std::string::npos)
+            {
+                /* parse in place, only the body remains buffered */
+                auto headers = parse_headers(std::string_view(buffer).substr(0, marker_pos + marker_len));
+                buffer.erase(0, marker_pos + marker_len);
+                return headers;
+            }
+
+            start_pos = buffer.length() > marker_len ? buffer.length() - marker_len + 1 : 0;
+
+            /* small reads keep the body bytes copied through the backlog few */
+            auto buff = scratch_buffer();
+
+            auto bytes_read = receive(buff, RCV_LARGE_BUFF_SIZE);
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to retrieve http headers: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Invalid server response: Unable to retrieve headers");
+            }
+
+            buffer.append(buff, bytes_read);
+        }
+    }
+
+    void Connection::download(ISink& sink)
+    {
+        download(sink, retrieve_headers());
+    }
+
+    void Connection::download(ISink& sink, const header_list_t& headers)
+    {
+        auto it = headers.find("transfer-encoding");
+
+        if (it == headers.end())
+        {
+            it = headers.find("content-length");
+
+            if (it == headers.end())
+            {
+                throw std::runtime_error("Invalid headers. Neither Transfer-Encoding nor Content-Length are present.");
+            }
+
+            auto length = std::strtoll(it->second.c_str(), nullptr, 10);
+
+            if (progress)
+            {
+                /* partial content reports the complete length after slash */
+                auto range = headers.find("content-range");
+                auto slash = range != headers.end() ? range->second.rfind('/') : std::string::npos;
+                auto total = slash != std::string::npos ? std::strtoll(range->second.c_str() + slash + 1, nullptr, 10) : length;
+
+                progress->start();
+                progress->set_total(total);
+            }
+
+            sink.reserve(length);
+            download_content(sink, length);
+
+            if (progress)
+            {
+                progress->stop();
+            }
+        }
+        else
+        {
+            auto encoding = it->second;
+            str_tolower(encoding);
+
+            if (encoding.find("chunked") == std::string::npos)
+            {
+                std::string msg = "Unsupported Transfer-Encoding: ";
+                msg += encoding;
+                throw std::runtime_error(msg);
+            }
+
+            if (progress)
+            {
+                progress->start();
+                progress->set_total(0);
+            }
+
+            download_chunks(sink);
+
+            if (progress)
+            {
+                progress->stop();
+            }
+        }
+
+        sink.finish();
+    }
+
+    void Connection::apply_receive_timeout()
+    {
+        timeval tv;
+        tv.tv_sec = receive_timeout.count();
+        tv.tv_usec = 0;
+
+        if (::setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv)) == -1)
+        {
+            close();
+            std::string msg = "Could not set socket option SO_RCVTIMEO: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+    }
+
+    int Connection::wait_until_connected()
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(DOWNLOAD_CONNECT_TIMEOUT_S);
+
+        while (true)
+        {
+            check_if_canceled();
+
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+            if (left <= 0)
+                return ETIMEDOUT;
+
+            /* the token and progress are polled between the slices */
+            pollfd pfds[2] = { { sock, POLLOUT, 0 }, { abort_fd, POLLIN, 0 } };
+            auto res = ::poll(pfds, abort_fd >= 0 ? 2 : 1, std::min<long>(left, CONNECT_POLL_INTERVAL_MS));
+
+            if (res < 0 && errno != EINTR)
+                return errno;
+
+            if (res > 0 && pfds[0].revents)
+            {
+                /* abort() shuts the socket down, that is not a connect error */
+                check_if_canceled();
+
+                int err = 0;
+                socklen_t len = sizeof(err);
+
+                if (::getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                    return errno;
+
+                return err;
+            }
+        }
+    }
+
+    ssize_t Connection::receive(char* buff, size_t len)
+    {
+        if (tls)
+            return tls->read(buff, len);
+
+        return ::recv(sock, buff, len, 0);
+    }
+
+    void Connection::write(ISink& sink, const char* buff, size_t len)
+    {
+        sink.write(buff, len);
+        account(len);
+    }
+
+    void Connection::account(size_t len)
+    {
+        content_received += len;
+
+        if (progress)
+        {
+            progress->add_progress(len);
+        }
+
+        speed_monitor.add(len);
+        Stats::shared().add_bytes(len);
+
+        if (transfer_stats)
+            transfer_stats->add(len);
+    }
+
+    void Connection::close() noexcept
+    {
+        tls.reset();
+
+        if (sock > 0)
+        {
+            ::close(sock);
+            sock = -1;
+            Stats::shared().socket_closed();
+        }
+
+        if (progress)
+        {
+            progress->stop();
+        }
+
+        release_buffers();
+    }
+
+    void Connection::release_buffers() noexcept
+    {
+        /* the request is over, its parse state goes back to the pool in one go */
+        buffer = std::pmr::string(&arena);
+        scratch = Buffer_Pool::Block();
+        arena.reset();
+    }
+
+    char* Connection::scratch_buffer()
+    {
+        if (!scratch.data())
+            scratch = Buffer_Pool::shared().acquire();
+
+        return scratch.data();
+    }
+
+    void Connection::check_if_canceled()
+    {
+        if (aborted || cancel_token.is_canceled() || (progress && progress->is_canceled()))
+            throw std::runtime_error("Canceled.");
+    }
+
+    void Connection::download_content(ISink& sink, ssize_t len)
+    {
+        if (len < static_cast<ssize_t>(buffer.length()))
+        {
+            throw std::runtime_error("Unable to get content");
+        }
+
+        write(sink, buffer.data(), buffer.length());
+        len -= buffer.length();
+        buffer.clear();
+
+        auto direct = dynamic_cast<IDirect_Sink*>(&sink);
+
+        while (len)
+        {
+            check_if_canceled();
+
+            char* dest = nullptr;
+            size_t dest_len = 0;
+
+            /* receive straight into sink memory if it is able */
+            if (direct)
+            {
+                size_t direct_len = len;
+
+                if (auto p = direct->acquire(direct_len))
+                {
+                    dest = p;
+                    dest_len = direct_len;
+                }
+            }
+
+            if (!dest)
+            {
+                dest = scratch_buffer();
+                dest_len = scratch.size();
+            }
+
+            auto bytes_read = receive(dest, dest_len);
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to download content: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Invalid server response: Unable to download content.");
+            }
+
+            if (dest != scratch.data())
+            {
+                direct->commit(bytes_read);
+                account(bytes_read);
+            }
+            else
+            {
+                write(sink, dest, bytes_read);
+            }
+
+            len = len > bytes_read ? len - bytes_read : 0;
+        }
+    }
+
+    void Connection::download_chunks(ISink& sink)
+    {
+        while (size_t len = get_chunk_length())
+        {
+            download_chunk(sink, len);
+        }
+    }
+
+    ssize_t Connection::get_chunk_length()
+    {
+        ssize_t length = 0;
+
+        const char* marker = "\r\n";
+        const auto marker_len = std::strlen(marker);
+
+        std::string::size_type find_start_pos = 0;
+        std::string::size_type number_start_pos = 0;
+        std::string::size_type marker_pos = std::string::npos;
+
+        while (true)
+        {
+            check_if_canceled();
+
+            marker_pos = buffer.find(marker, find_start_pos);
+
+            if (marker_pos != std::string::npos)
+            {
+                /* skip leading crlf */
+                if (marker_pos == 0)
+                {
+                    number_start_pos = marker_len;
+                    find_start_pos = marker_len;
+                    continue;
+                }
+                else
+                {
+                    /* the number ends at cr, so strtoll stops there without a copy */
+                    length = std::strtoll(buffer.c_str() + number_start_pos, nullptr, 16);
+                    buffer.erase(0, marker_pos + marker_len);
+                    break;
+                }
+            }
+
+            find_start_pos = buffer.length() > marker_len ? buffer.length() - marker_len + 1 : 0;
+
+            auto buff = scratch_buffer();
+
+            auto bytes_read = receive(buff, scratch.size());
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to obtain chunk length: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Invalid server response: Unable to obtain chunk length.");
+            }
+
+            buffer.append(buff, bytes_read);
+        }
+
+        return length;
+    }
+
+    void Connection::download_chunk(ISink& sink, ssize_t len)
+    {
+        if (len < static_cast<ssize_t>(buffer.length()))
+        {
+            write(sink, buffer.data(), len);
+            buffer.erase(0, len);
+            return;
+        }
+
+        write(sink, buffer.data(), buffer.length());
+        len -= buffer.length();
+        buffer.clear();
+
+        while (len)
+        {
+            check_if_canceled();
+
+            auto buff = scratch_buffer();
+
+            auto bytes_read = receive(buff, scratch.size());
+
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to download chunk: ";
+                msg += strerror(errno);
+                throw Transfer_Error(msg);
+            }
+
+            if (bytes_read == 0)
+            {
+                throw Transfer_Error("Invalid server response: Unable to download chunk.");
+            }
+
+            if (len < bytes_read)
+            {
+                write(sink, buff, len);
+                buffer.append(&buff[len], bytes_read - len);
+                break;
+            }
+
+            write(sink, buff, bytes_read);
+            len = len - bytes_read;
+        }
+    }
+}
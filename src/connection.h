@@ -0,0 +1,94 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <memory_resource>
+#include <string>
+
+#include "buffers.h"
+#include "cancel.h"
+#include "iprogress.h"
+#include "isink.h"
+#include "protocol.h"
+#include "retry.h"
+#include "stats.h"
+#include "tls.h"
+
+namespace http
+{
+    class Connection
+    {
+    public:
+        Connection(ipgrogress_ptr_t& pr) noexcept;
+        ~Connection();
+
+        void connect(const std::string& host, std::uint16_t port);
+        void connect(const std::string& host, in_addr addr, std::uint16_t port);
+        void send_request(const std::string& request) const;
+        Status_Line retrieve_http_status_line();
+        header_list_t retrieve_headers();
+        void download(ISink& sink);
+        void download(ISink& sink, const header_list_t& headers);
+
+        /* raw bytes for protocols framed on top of the connection */
+        size_t read(char* buff, size_t len);
+
+        void set_receive_timeout(std::chrono::seconds timeout) noexcept;
+        void set_speed_limit(size_t limit, std::chrono::seconds window) noexcept;
+        void set_cancel_token(const Cancel_Token& token) noexcept;
+        void set_transfer_stats(Transfer_Stats* stats) noexcept;
+        void set_secure(bool secure) noexcept;
+        bool is_secure() const noexcept;
+        bool is_resumed() const noexcept;
+        bool is_reused() const noexcept;
+        size_t received() const noexcept;
+        in_addr peer() const noexcept;
+
+        /* interrupts transfer from another thread */
+        void abort() noexcept;
+
+        /* returns connection to the pool if the response allows to keep it */
+        void recycle(const Status_Line& status, const header_list_t& headers) noexcept;
+
+    private:
+        void apply_receive_timeout();
+        int wait_until_connected();
+        ssize_t receive(char* buff, size_t len);
+        void write(ISink& sink, const char* buff, size_t len);
+        void account(size_t len);
+        void close() noexcept;
+        void release_buffers() noexcept;
+        char* scratch_buffer();
+        void check_if_canceled();
+
+        void download_content(ISink& sink, ssize_t len);
+        void download_chunks(ISink& sink);
+        ssize_t get_chunk_length();
+        void download_chunk(ISink& sink, ssize_t len);
+
+    private:
+        std::atomic_int sock = -1;
+        int abort_fd = -1;                  /* eventfd, wakes up connect on abort */
+        in_addr peer_addr {};
+        bool secure = false;
+        bool reused = false;
+        std::string pool_key;
+        std::unique_ptr<Tls_Session> tls;
+        Arena arena;
+        std::pmr::string buffer { &arena };
+        Buffer_Pool::Block scratch;
+        ipgrogress_ptr_t& progress;
+        Cancel_Token cancel_token;
+        Transfer_Stats* transfer_stats = nullptr;
+        std::chrono::seconds receive_timeout { DOWNLOAD_RCV_TIMEOUT_S };
+        Speed_Monitor speed_monitor;
+        std::atomic<size_t> content_received = 0;
+        std::atomic_bool aborted = false;
+    };
+}
+
+#endif // CONNECTION_H
@@ -0,0 +1,511 @@
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+#include "daemon.h"
+
+#define DAEMON_SOCKET_NAME          "downloader.sock"
+#define DAEMON_POLL_INTERVAL_MS     200
+#define DAEMON_REQUEST_TIMEOUT_S    5
+#define DAEMON_PROGRESS_INTERVAL_MS 100
+#define DAEMON_MAX_LINE_LENGTH      16384
+#define DAEMON_MAX_PENDING          256
+
+namespace http
+{
+    namespace
+    {
+        struct Client
+        {
+            explicit Client(int s) noexcept :
+                sock(s)
+            {
+
+            }
+
+            ~Client()
+            {
+                ::close(sock);
+            }
+
+            bool send(const std::string& line) noexcept
+            {
+                size_t sent = 0;
+
+                while (!broken && sent < line.length())
+                {
+                    auto res = ::send(sock, line.c_str() + sent, line.length() - sent, MSG_NOSIGNAL);
+
+                    if (res < 0)
+                    {
+                        if (errno != EINTR)
+                            broken = true;
+
+                        continue;
+                    }
+
+                    sent += res;
+                }
+
+                return !broken;
+            }
+
+            int sock;
+            std::atomic_bool broken = false;
+        };
+
+        /* reports progress to the client, a gone client cancels the job */
+        class Socket_Progress : public IProgress
+        {
+        public:
+            explicit Socket_Progress(std::shared_ptr<Client> c) noexcept :
+                client(std::move(c))
+            {
+
+            }
+
+            void start() override
+            {
+                started = true;
+            }
+
+            void stop() override
+            {
+                if (started)
+                    report(true);
+
+                started = false;
+            }
+
+            void set_total(size_t t) override
+            {
+                total = t;
+            }
+
+            void add_progress(size_t c) override
+            {
+                current += c;
+                report(false);
+            }
+
+            bool is_canceled() override
+            {
+                return client->broken;
+            }
+
+        private:
+            void report(bool force)
+            {
+                auto now = std::chrono::steady_clock::now();
+
+                if (!force && now - last < std::chrono::milliseconds(DAEMON_PROGRESS_INTERVAL_MS))
+                    return;
+
+                last = now;
+
+                std::string line = "progress\t";
+                line += std::to_string(current);
+                line += '\t';
+                line += std::to_string(total);
+                line += '\n';
+                client->send(line);
+            }
+
+        private:
+            std::shared_ptr<Client> client;
+            bool started = false;
+            size_t total = 0;
+            size_t current = 0;
+            std::chrono::steady_clock::time_point last;
+        };
+
+        /* on receive timeout keep waiting unless interrupted */
+        bool read_line(int sock, std::string& buffer, std::string& line, const std::function<bool()>& interrupted)
+        {
+            while (true)
+            {
+                auto pos = buffer.find('\n');
+
+                if (pos != std::string::npos)
+                {
+                    line = buffer.substr(0, pos);
+                    buffer.erase(0, pos + 1);
+                    return true;
+                }
+
+                if (buffer.length() > DAEMON_MAX_LINE_LENGTH)
+                    return false;
+
+                char buff[1024];
+                auto res = ::recv(sock, buff, sizeof(buff), 0);
+
+                if (res < 0 && errno == EINTR)
+                    continue;
+
+                if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !interrupted())
+                    continue;
+
+                if (res <= 0)
+                    return false;
+
+                buffer.append(buff, res);
+            }
+        }
+
+        /* connection whose request line is not received yet */
+        struct Pending
+        {
+            int sock;
+            std::string buffer;
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        enum class Receive_Status
+        {
+            partial,
+            complete,
+            failed
+        };
+
+        Receive_Status receive_request(Pending& pending, std::string& line)
+        {
+            char buff[1024];
+            auto res = ::recv(pending.sock, buff, sizeof(buff), MSG_DONTWAIT);
+
+            if (res < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+                return Receive_Status::partial;
+
+            if (res <= 0)
+                return Receive_Status::failed;
+
+            pending.buffer.append(buff, res);
+
+            auto pos = pending.buffer.find('\n');
+
+            if (pos != std::string::npos)
+            {
+                line = pending.buffer.substr(0, pos);
+                return Receive_Status::complete;
+            }
+
+            return pending.buffer.length() > DAEMON_MAX_LINE_LENGTH ? Receive_Status::failed : Receive_Status::partial;
+        }
+
+        std::vector<std::string> split(const std::string& line)
+        {
+            std::vector<std::string> fields;
+            std::istringstream in(line);
+            std::string field;
+
+            while (std::getline(in, field, '\t'))
+                fields.push_back(field);
+
+            /* trailing empty field is dropped by getline */
+            if (!line.empty() && line.back() == '\t')
+                fields.emplace_back();
+
+            return fields;
+        }
+
+        sockaddr_un socket_address(const std::filesystem::path& path)
+        {
+            sockaddr_un addr {};
+            addr.sun_family = AF_UNIX;
+
+            if (path.native().length() >= sizeof(addr.sun_path))
+            {
+                std::string msg = "Socket path is too long: ";
+                msg += path.string();
+                throw std::invalid_argument(msg);
+            }
+
+            std::strcpy(addr.sun_path, path.c_str());
+            return addr;
+        }
+
+        int connect_to(const std::filesystem::path& path)
+        {
+            auto addr = socket_address(path);
+            int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+            if (sock < 0)
+                return -1;
+
+            if (::connect(sock, (const sockaddr*) &addr, sizeof(addr)) < 0)
+            {
+                ::close(sock);
+                return -1;
+            }
+
+            return sock;
+        }
+    }
+
+    Daemon::Daemon(const std::filesystem::path& path, size_t threads) :
+        socket_path(path),
+        engine(threads)
+    {
+        auto addr = socket_address(socket_path);
+
+        if (std::filesystem::exists(socket_path))
+        {
+            int sock = connect_to(socket_path);
+
+            if (sock >= 0)
+            {
+                ::close(sock);
+                std::string msg = "Daemon is already running on '";
+                msg += socket_path.string();
+                msg += "'.";
+                throw std::runtime_error(msg);
+            }
+
+            /* left by a daemon which was killed */
+            std::filesystem::remove(socket_path);
+        }
+
+        listen_sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        if (listen_sock < 0 ||
+            ::bind(listen_sock, (const sockaddr*) &addr, sizeof(addr)) < 0 ||
+            ::chmod(socket_path.c_str(), 0600) < 0 ||
+            ::listen(listen_sock, SOMAXCONN) < 0)
+        {
+            std::string msg = "Unable to listen on '";
+            msg += socket_path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+
+            if (listen_sock >= 0)
+                ::close(listen_sock);
+
+            throw std::runtime_error(msg);
+        }
+    }
+
+    Daemon::~Daemon()
+    {
+        ::close(listen_sock);
+        ::unlink(socket_path.c_str());
+    }
+
+    void Daemon::set_retry_policy(const Retry_Policy& policy) noexcept
+    {
+        retry_policy = policy;
+    }
+
+    void Daemon::set_output_mode(Output_Mode mode) noexcept
+    {
+        output_mode = mode;
+    }
+
+    void Daemon::run(const Cancel_Token& stop)
+    {
+        /* requests are read as they arrive, a slow client does not hold up the others */
+        std::vector<Pending> pending;
+        std::vector<pollfd> pfds;
+
+        while (!stop.is_canceled())
+        {
+            pfds.clear();
+            pfds.push_back({ listen_sock, static_cast<short>(pending.size() < DAEMON_MAX_PENDING ? POLLIN : 0), 0 });
+
+            for (const auto& client : pending)
+                pfds.push_back({ client.sock, POLLIN, 0 });
+
+            if (::poll(pfds.data(), pfds.size(), DAEMON_POLL_INTERVAL_MS) < 0)
+                continue;
+
+            auto now = std::chrono::steady_clock::now();
+            std::vector<Pending> waiting;
+
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                auto& client = pending[i];
+                std::string line;
+                auto status = pfds[i + 1].revents ? receive_request(client, line) : Receive_Status::partial;
+
+                if (status == Receive_Status::complete)
+                    serve(client.sock, line);
+                else if (status == Receive_Status::partial && now < client.deadline)
+                    waiting.push_back(std::move(client));
+                else
+                    ::close(client.sock);
+            }
+
+            pending = std::move(waiting);
+
+            if (pfds[0].revents & POLLIN)
+            {
+                int client = ::accept4(listen_sock, nullptr, nullptr, SOCK_CLOEXEC);
+
+                if (client >= 0)
+                    pending.push_back({ client, std::string(), now + std::chrono::seconds(DAEMON_REQUEST_TIMEOUT_S) });
+            }
+        }
+
+        for (const auto& client : pending)
+            ::close(client.sock);
+    }
+
+    std::filesystem::path Daemon::default_socket_path()
+    {
+        if (auto dir = std::getenv("XDG_RUNTIME_DIR"))
+            return std::filesystem::path(dir) / DAEMON_SOCKET_NAME;
+
+        std::string name = "downloader-";
+        name += std::to_string(::getuid());
+        name += ".sock";
+        return std::filesystem::temp_directory_path() / name;
+    }
+
+    void Daemon::serve(int sock, const std::string& request)
+    {
+        auto client = std::make_shared<Client>(sock);
+        auto fields = split(request);
+
+        if (fields.size() != 5 || fields[0] != "fetch")
+        {
+            client->send("error\tInvalid request.\n");
+            return;
+        }
+
+        Job job;
+        job.url = fields[1];
+        job.directory = fields[2];
+        job.file_name = fields[3];
+        job.rewrite = fields[4] == "1";
+        job.output_mode = output_mode;
+        job.retry = retry_policy;
+        job.progress = std::make_unique<Socket_Progress>(client);
+        job.on_complete = [client](const Job_Result& result)
+        {
+            std::string line;
+
+            try
+            {
+                if (result.error)
+                    std::rethrow_exception(result.error);
+
+                line = "done\t";
+                line += result.path.string();
+            }
+            catch (const std::exception& e)
+            {
+                line = "error\t";
+                line += e.what();
+            }
+
+            line += '\n';
+            client->send(line);
+        };
+
+        try
+        {
+            engine.submit(std::move(job));
+        }
+        catch (const std::exception& e)
+        {
+            std::string msg = "error\t";
+            msg += e.what();
+            msg += '\n';
+            client->send(msg);
+        }
+    }
+
+    std::filesystem::path submit_to_daemon(const std::filesystem::path& socket_path,
+                                           const Daemon_Request& request,
+                                           IProgress* progress)
+    {
+        for (const auto& field : { request.url, request.directory.string(), request.file_name.string() })
+        {
+            if (field.find_first_of("\t\n") != std::string::npos)
+                throw std::invalid_argument("Tabs and line breaks are not allowed in daemon requests.");
+        }
+
+        int sock = connect_to(socket_path);
+
+        if (sock < 0)
+        {
+            std::string msg = "Unable to connect to daemon on '";
+            msg += socket_path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        Client daemon(sock);
+
+        std::string line = "fetch\t";
+        line += request.url;
+        line += '\t';
+        line += request.directory.string();
+        line += '\t';
+        line += request.file_name.string();
+        line += request.rewrite ? "\t1\n" : "\t0\n";
+
+        if (!daemon.send(line))
+            throw std::runtime_error("Unable to send request to daemon.");
+
+        timeval tv { 0, DAEMON_POLL_INTERVAL_MS * 1000 };
+        ::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        /* closed connection cancels the job in daemon */
+        auto interrupted = [progress]{ return progress && progress->is_canceled(); };
+
+        std::string buffer;
+        size_t reported = 0;
+        bool started = false;
+
+        while (read_line(sock, buffer, line, interrupted))
+        {
+            auto fields = split(line);
+
+            if (fields.size() == 3 && fields[0] == "progress")
+            {
+                if (!progress)
+                    continue;
+
+                if (!started)
+                {
+                    progress->start();
+                    started = true;
+                }
+
+                size_t received = std::strtoull(fields[1].c_str(), nullptr, 10);
+                progress->set_total(std::strtoull(fields[2].c_str(), nullptr, 10));
+
+                if (received > reported)
+                {
+                    progress->add_progress(received - reported);
+                    reported = received;
+                }
+
+                continue;
+            }
+
+            if (progress && started)
+                progress->stop();
+
+            if (fields.size() == 2 && fields[0] == "done")
+                return fields[1];
+
+            if (fields.size() >= 2 && fields[0] == "error")
+                throw std::runtime_error(line.substr(6));
+
+            throw std::runtime_error("Invalid daemon response.");
+        }
+
+        if (interrupted())
+            throw std::runtime_error("Canceled.");
+
+        throw std::runtime_error("Connection to daemon is lost.");
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <filesystem>
+#include <string>
+
+#include "cancel.h"
+#include "engine.h"
+#include "iprogress.h"
+
+/*
+ * Long running download service on a Unix domain socket. Worker threads,
+ * resolved names, TLS sessions and keep-alive connections stay warm
+ * between jobs.
+ *
+ * One job per client connection, tab separated text lines:
+ *     client: fetch <url> <directory> <file name> <rewrite 0|1>
+ *     daemon: progress <received> <total>      (zero or more)
+ *             done <path> | error <message>    (once, then close)
+*/
+
+namespace http
+{
+    struct Daemon_Request
+    {
+        std::string url;
+        std::filesystem::path directory;
+        std::filesystem::path file_name;
+        bool rewrite = false;
+    };
+
+    class Daemon
+    {
+    public:
+        Daemon(const std::filesystem::path& socket_path, size_t threads);
+        ~Daemon();
+
+        Daemon(const Daemon&) = delete;
+        Daemon& operator=(const Daemon&) = delete;
+
+        void set_retry_policy(const Retry_Policy& policy) noexcept;
+        void set_output_mode(Output_Mode mode) noexcept;
+
+        /* serves clients until the token is canceled */
+        void run(const Cancel_Token& stop);
+
+        static std::filesystem::path default_socket_path();
+
+    private:
+        void serve(int client, const std::string& request);
+
+    private:
+        std::filesystem::path socket_path;
+        int listen_sock = -1;
+        Engine engine;
+        Retry_Policy retry_policy;
+        Output_Mode output_mode = Output_Mode::stream;
+    };
+
+    /* submits a job to the daemon and waits for it, returns the downloaded file path */
+    std::filesystem::path submit_to_daemon(const std::filesystem::path& socket_path,
+                                           const Daemon_Request& request,
+                                           IProgress* progress);
+}
+
+#endif // DAEMON_H
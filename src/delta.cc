@@ -0,0 +1,580 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "connection.h"
+#include "delta.h"
+#include "http.h"
+
+#define DELTA_MAX_RANGES            64
+#define DELTA_MAX_PART_HEADERS      8192
+#define DELTA_COPY_BUFF_SIZE        65536
+
+namespace http
+{
+    namespace
+    {
+        /* rsync rolling checksum, both halves modulo 2^16 */
+        struct Rolling_Checksum
+        {
+            std::uint32_t a = 0;
+            std::uint32_t b = 0;
+
+            Rolling_Checksum(const unsigned char* data, size_t len) noexcept
+            {
+                for (size_t i = 0; i < len; ++i)
+                {
+                    a += data[i];
+                    b += (len - i) * data[i];
+                }
+            }
+
+            void roll(unsigned char out, unsigned char in, size_t len) noexcept
+            {
+                a = a - out + in;
+                b = b - len * out + a;
+            }
+
+            std::uint32_t value() const noexcept
+            {
+                return (a & 0xffff) | (b << 16);
+            }
+        };
+
+        Block_Index::digest_t md5(const unsigned char* data, size_t len)
+        {
+            Block_Index::digest_t digest;
+            unsigned int digest_len = 0;
+
+            if (!::EVP_Digest(data, len, digest.data(), &digest_len, ::EVP_md5(), nullptr))
+                throw std::runtime_error("Unable to compute block digest.");
+
+            return digest;
+        }
+
+        void pwrite_all(int fd, const char* data, size_t len, size_t offset)
+        {
+            while (len)
+            {
+                auto res = ::pwrite(fd, data, len, offset);
+
+                if (res < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    std::string msg = "Unable to write file: ";
+                    msg += ::strerror(errno);
+                    throw std::runtime_error(msg);
+                }
+
+                data += res;
+                len -= res;
+                offset += res;
+            }
+        }
+
+        /* writes received ranges at their offsets, splits multipart/byteranges body */
+        class Ranges_Sink : public ISink
+        {
+        public:
+            Ranges_Sink(int f, bool mp, size_t o) noexcept :
+                fd(f),
+                multipart(mp),
+                offset(o)
+            {
+
+            }
+
+            void reserve(size_t) noexcept override
+            {
+
+            }
+
+            void write(const char* data, size_t len) override
+            {
+                while (len)
+                {
+                    if (!multipart || remaining)
+                    {
+                        auto n = multipart ? std::min(len, remaining) : len;
+                        pwrite_all(fd, data, n, offset);
+
+                        offset += n;
+                        remaining -= multipart ? n : 0;
+                        data += n;
+                        len -= n;
+                        continue;
+                    }
+
+                    /* boundary line and part headers */
+                    pending.append(data, len);
+                    len = 0;
+
+                    auto end = pending.find("\r\n\r\n");
+
+                    if (end == std::string::npos)
+                    {
+                        if (pending.length() > DELTA_MAX_PART_HEADERS)
+                            throw std::runtime_error("Invalid server response: Malformed multipart body.");
+
+                        break;
+                    }
+
+                    auto headers = pending.substr(0, end);
+                    auto rest = pending.substr(end + 4);
+                    pending.clear();
+
+                    str_tolower(headers);
+                    auto pos = headers.rfind("content-range:");
+
+                    if (pos == std::string::npos)
+                        throw std::runtime_error("Invalid server response: Multipart body without Content-Range.");
+
+                    pos = headers.find_first_of("0123456789", pos);
+
+                    if (pos == std::string::npos)
+                        throw std::runtime_error("Invalid server response: Malformed Content-Range.");
+
+                    char* next = nullptr;
+                    size_t first = std::strtoull(headers.c_str() + pos, &next, 10);
+                    size_t last = *next == '-' ? std::strtoull(next + 1, nullptr, 10) : 0;
+
+                    if (last < first)
+                        throw std::runtime_error("Invalid server response: Malformed Content-Range.");
+
+                    offset = first;
+                    remaining = last - first + 1;
+
+                    write(rest.data(), rest.length());
+                }
+            }
+
+            void finish() override
+            {
+                if (remaining)
+                    throw Transfer_Error("Invalid server response: Multipart body is truncated.");
+            }
+
+        private:
+            int fd;
+            bool multipart;
+            size_t offset;
+            size_t remaining = 0;
+            std::string pending;
+        };
+
+        std::string to_hex(const unsigned char* data, size_t len)
+        {
+            std::ostringstream out;
+            out << std::hex << std::setfill('0');
+
+            for (size_t i = 0; i < len; ++i)
+                out << std::setw(2) << static_cast<unsigned>(data[i]);
+
+            return out.str();
+        }
+
+        bool from_hex(const std::string& str, unsigned char* data, size_t len)
+        {
+            if (str.length() != len * 2)
+                return false;
+
+            for (size_t i = 0; i < len; ++i)
+            {
+                char* end = nullptr;
+                auto byte = str.substr(i * 2, 2);
+                data[i] = static_cast<unsigned char>(std::strtoul(byte.c_str(), &end, 16));
+
+                if (*end)
+                    return false;
+            }
+
+            return true;
+        }
+    }
+
+    Block_Index Block_Index::create(const std::filesystem::path& file, size_t block_size)
+    {
+        if (block_size == 0)
+            throw std::invalid_argument("Block size shall not be zero.");
+
+        std::ifstream in(file, std::ios::binary);
+
+        if (!in.is_open())
+        {
+            std::string msg = "Unable to open file '";
+            msg += file.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+
+        Block_Index index;
+        index.block_size = block_size;
+
+        std::vector<unsigned char> buff(block_size);
+
+        while (in.read(reinterpret_cast<char*>(buff.data()), block_size) || in.gcount())
+        {
+            size_t len = in.gcount();
+
+            Block block;
+            block.weak = Rolling_Checksum(buff.data(), len).value();
+            block.strong = md5(buff.data(), len);
+
+            index.blocks.push_back(block);
+            index.length += len;
+        }
+
+        return index;
+    }
+
+    Block_Index Block_Index::parse(std::istream& in)
+    {
+        Block_Index index;
+        std::string line;
+
+        while (std::getline(in, line) && !line.empty() && line != "\r")
+        {
+            auto colon = line.find(':');
+
+            if (colon == std::string::npos)
+                throw std::invalid_argument("Invalid block index header.");
+
+            auto name = line.substr(0, colon);
+            auto value = std::strtoull(line.c_str() + colon + 1, nullptr, 10);
+            str_tolower(name);
+
+            if (name == "length")
+                index.length = value;
+            else if (name == "blocksize")
+                index.block_size = value;
+        }
+
+        if (index.block_size == 0)
+            throw std::invalid_argument("Invalid block index: Blocksize is not specified.");
+
+        std::string weak, strong;
+
+        while (in >> weak >> strong)
+        {
+            Block block;
+            char* end = nullptr;
+            block.weak = std::strtoul(weak.c_str(), &end, 16);
+
+            if (*end || !from_hex(strong, block.strong.data(), block.strong.size()))
+                throw std::invalid_argument("Invalid block index: Malformed checksum.");
+
+            index.blocks.push_back(block);
+        }
+
+        if (index.blocks.size() != (index.length + index.block_size - 1) / index.block_size)
+            throw std::invalid_argument("Invalid block index: Number of blocks does not match length.");
+
+        return index;
+    }
+
+    void Block_Index::save(std::ostream& out) const
+    {
+        out << "Length: " << length << '\n'
+            << "Blocksize: " << block_size << '\n'
+            << '\n';
+
+        for (const auto& block : blocks)
+        {
+            out << std::hex << std::setfill('0') << std::setw(8) << block.weak << std::dec << ' '
+                << to_hex(block.strong.data(), block.strong.size()) << '\n';
+        }
+    }
+
+    Delta_Sync::Delta_Sync(ipgrogress_ptr_t pr) noexcept :
+        progress(std::move(pr))
+    {
+
+    }
+
+    Delta_Result Delta_Sync::sync(const std::string& url,
+                                  const std::filesystem::path& local,
+                                  const Block_Index& index)
+    {
+        auto offsets = match(local, index);
+
+        auto tmpl = local.string() + ".delta-XXXXXX";
+        int fd = ::mkostemp(tmpl.data(), O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            std::string msg = "Unable to create temporary file '";
+            msg += tmpl;
+            msg += "': ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        Delta_Result result;
+
+        try
+        {
+            ::fchmod(fd, 0644);
+
+            if (::ftruncate(fd, index.length) < 0)
+            {
+                std::string msg = "Unable to size file: ";
+                msg += ::strerror(errno);
+                throw std::runtime_error(msg);
+            }
+
+            /* reuse local blocks, collect the missing ones into ranges */
+            std::vector<range_t> ranges;
+            int src = ::open(local.c_str(), O_RDONLY | O_CLOEXEC);
+
+            for (size_t i = 0; i < index.blocks.size(); ++i)
+            {
+                auto first = i * index.block_size;
+                auto len = std::min(index.block_size, index.length - first);
+
+                if (offsets[i] == std::string::npos)
+                {
+                    if (!ranges.empty() && ranges.back().second + 1 == first)
+                        ranges.back().second += len;
+                    else
+                        ranges.emplace_back(first, first + len - 1);
+
+                    result.fetched += len;
+                    continue;
+                }
+
+                loff_t in = offsets[i];
+                loff_t out = first;
+                size_t left = len;
+
+                while (left)
+                {
+                    auto res = ::copy_file_range(src, &in, fd, &out, left, 0);
+
+                    if (res <= 0)
+                        break;
+
+                    left -= res;
+                }
+
+                /* file systems without copy_file_range */
+                while (left)
+                {
+                    char buff[DELTA_COPY_BUFF_SIZE];
+                    auto res = ::pread(src, buff, std::min(left, sizeof(buff)), in);
+
+                    if (res <= 0)
+                    {
+                        ::close(src);
+                        throw std::runtime_error("Unable to read local file.");
+                    }
+
+                    pwrite_all(fd, buff, res, out);
+                    in += res;
+                    out += res;
+                    left -= res;
+                }
+
+                result.reused += len;
+            }
+
+            if (src >= 0)
+                ::close(src);
+
+            for (size_t i = 0; i < ranges.size(); i += DELTA_MAX_RANGES)
+            {
+                std::vector<range_t> batch(ranges.begin() + i,
+                                           ranges.begin() + std::min(ranges.size(), i + DELTA_MAX_RANGES));
+
+                /* server which ignores ranges sends everything at once */
+                if (!fetch(url, fd, batch))
+                    break;
+            }
+
+            verify(fd, index, offsets);
+
+            std::filesystem::rename(tmpl, local);
+        }
+        catch (...)
+        {
+            ::close(fd);
+            ::unlink(tmpl.c_str());
+            throw;
+        }
+
+        ::close(fd);
+
+        return result;
+    }
+
+    std::vector<size_t> Delta_Sync::match(const std::filesystem::path& local, const Block_Index& index)
+    {
+        const auto block_size = index.block_size;
+        std::vector<size_t> offsets(index.blocks.size(), std::string::npos);
+
+        /* the tail shorter than a block is always fetched */
+        std::unordered_map<std::uint32_t, std::vector<size_t>> table;
+
+        for (size_t i = 0; (i + 1) * block_size <= index.length; ++i)
+            table[index.blocks[i].weak].push_back(i);
+
+        int fd = ::open(local.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            return offsets;
+
+        struct stat st;
+        size_t size = ::fstat(fd, &st) == 0 ? st.st_size : 0;
+
+        if (size < block_size || table.empty())
+        {
+            ::close(fd);
+            return offsets;
+        }
+
+        auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (addr == MAP_FAILED)
+            return offsets;
+
+        ::madvise(addr, size, MADV_SEQUENTIAL);
+
+        auto data = static_cast<const unsigned char*>(addr);
+        size_t pos = 0;
+        Rolling_Checksum sum(data, block_size);
+
+        while (true)
+        {
+            bool matched = false;
+            auto it = table.find(sum.value());
+
+            if (it != table.end())
+            {
+                auto digest = md5(data + pos, block_size);
+
+                for (auto i : it->second)
+                {
+                    if (index.blocks[i].strong == digest)
+                    {
+                        if (offsets[i] == std::string::npos)
+                            offsets[i] = pos;
+
+                        matched = true;
+                    }
+                }
+            }
+
+            if (matched)
+            {
+                pos += block_size;
+
+                if (pos + block_size > size)
+                    break;
+
+                sum = Rolling_Checksum(data + pos, block_size);
+                continue;
+            }
+
+            if (pos + block_size >= size)
+                break;
+
+            sum.roll(data[pos], data[pos + block_size], block_size);
+            ++pos;
+        }
+
+        ::munmap(addr, size);
+
+        return offsets;
+    }
+
+    bool Delta_Sync::fetch(const std::string& url, int fd, const std::vector<range_t>& ranges)
+    {
+        auto info = Downloader::create_request_info(url);
+
+        if (info.protocol != "http" && info.protocol != "https")
+        {
+            std::string msg = "Unsupported protocol: ";
+            msg += info.protocol;
+            throw std::runtime_error(msg);
+        }
+
+        std::string range = "Range: bytes=";
+
+        for (const auto& [first, last] : ranges)
+        {
+            if (&first != &ranges.front().first)
+                range += ',';
+
+            range += std::to_string(first);
+            range += '-';
+            range += std::to_string(last);
+        }
+
+        range += "\r\n";
+
+        Connection connection(progress);
+        connection.set_secure(info.protocol == "https");
+        connection.connect(info.host, info.port);
+        connection.send_request(Downloader::create_get_request(info, range));
+
+        auto status = connection.retrieve_http_status_line();
+        auto headers = connection.retrieve_headers();
+
+        if (status.status_code == 206)
+        {
+            auto it = headers.find("content-type");
+            auto type = it != headers.end() ? it->second : std::string();
+            str_tolower(type);
+
+            auto multipart = type.find("multipart/byteranges") != std::string::npos;
+
+            Ranges_Sink sink(fd, multipart, multipart ? 0 : content_range_start(headers));
+            connection.download(sink, headers);
+            return true;
+        }
+
+        if (status.status_code == 200)
+        {
+            Ranges_Sink sink(fd, false, 0);
+            connection.download(sink, headers);
+            return false;
+        }
+        throw Status_Error(status.status_code, unsuccessful_status_message(status, headers));
+    }
+
+    void Delta_Sync::verify(int fd, const Block_Index& index, const std::vector<size_t>& offsets)
+    {
+        std::vector<unsigned char> buff(index.block_size);
+
+        for (size_t i = 0; i < index.blocks.size(); ++i)
+        {
+            if (offsets[i] != std::string::npos)
+                continue;
+
+            auto first = i * index.block_size;
+            auto len = std::min(index.block_size, index.length - first);
+
+            if (::pread(fd, buff.data(), len, first) != static_cast<ssize_t>(len) ||
+                md5(buff.data(), len) != index.blocks[i].strong)
+            {
+                std::string msg = "Block ";
+                msg += std::to_string(i);
+                msg += " does not match block index.";
+                throw std::runtime_error(msg);
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "iprogress.h"
+
+/*
+ * Delta synchronization in the manner of zsync: the block index of the
+ * remote file lists a rolling and a strong checksum of every block. Blocks
+ * found anywhere in the local copy are reused, the rest is fetched with
+ * multi-range requests.
+ *
+ * Block index format (text):
+ *     Length: <file length>
+ *     Blocksize: <block size>
+ *     <empty line>
+ *     <rolling checksum hex> <md5 hex>     one line per block
+*/
+
+namespace http
+{
+    struct Block_Index
+    {
+        using digest_t = std::array<unsigned char, 16>;
+
+        struct Block
+        {
+            std::uint32_t weak = 0;
+            digest_t strong {};
+        };
+
+        size_t length = 0;
+        size_t block_size = 0;
+        std::vector<Block> blocks;
+
+        static Block_Index create(const std::filesystem::path& file, size_t block_size);
+        static Block_Index parse(std::istream& in);
+        void save(std::ostream& out) const;
+    };
+
+    struct Delta_Result
+    {
+        size_t reused = 0;      /* bytes taken from the local copy */
+        size_t fetched = 0;     /* bytes requested from the server */
+    };
+
+    class Delta_Sync
+    {
+    public:
+        Delta_Sync(ipgrogress_ptr_t pr) noexcept;
+
+        /* rebuilds local file to match the remote one, replaces it atomically */
+        Delta_Result sync(const std::string& url,
+                          const std::filesystem::path& local,
+                          const Block_Index& index);
+
+    private:
+        using range_t = std::pair<size_t, size_t>;    /* first, last inclusive */
+
+        std::vector<size_t> match(const std::filesystem::path& local, const Block_Index& index);
+        bool fetch(const std::string& url, int fd, const std::vector<range_t>& ranges);
+        void verify(int fd, const Block_Index& index, const std::vector<size_t>& offsets);
+
+    private:
+        ipgrogress_ptr_t progress;
+    };
+}
+
+#endif // DELTA_H
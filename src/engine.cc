@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "engine.h"
+#include "http.h"
+#include "names.h"
+
+namespace http
+{
+    /* outlives the engine, so a handle can be canceled at any time */
+    struct Engine_Hook
+    {
+        std::recursive_mutex mutex;     /* a completion callback may cancel another job */
+        Engine* engine = nullptr;
+    };
+
+    Job_Handle::Job_Handle(Cancel_Token t, std::shared_future<Job_Result> f, std::shared_ptr<Engine_Hook> h) noexcept :
+        token(std::move(t)),
+        result(std::move(f)),
+        hook(std::move(h))
+    {
+
+    }
+
+    void Job_Handle::cancel() noexcept
+    {
+        if (token)
+            token->cancel();
+
+        if (hook)
+        {
+            std::lock_guard<std::recursive_mutex> lock(hook->mutex);
+
+            if (hook->engine)
+                hook->engine->reap();
+        }
+    }
+
+    bool Job_Handle::is_canceled() const noexcept
+    {
+        return token && token->is_canceled();
+    }
+
+    bool Job_Handle::valid() const noexcept
+    {
+        return result.valid();
+    }
+
+    void Job_Handle::wait() const
+    {
+        result.wait();
+    }
+
+    const Job_Result& Job_Handle::get() const
+    {
+        return result.get();
+    }
+
+    Engine::Engine(size_t threads) :
+        hook(std::make_shared<Engine_Hook>())
+    {
+        hook->engine = this;
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back(&Engine::run, this);
+    }
+
+    Engine::~Engine()
+    {
+        {
+            std::lock_guard<std::recursive_mutex> lock(hook->mutex);
+            hook->engine = nullptr;
+        }
+
+        shutdown();
+    }
+
+    Job_Handle Engine::submit(Job job)
+    {
+        Cancel_Token token;
+        std::promise<Job_Result> promise;
+        auto future = promise.get_future().share();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (stopping)
+                throw std::runtime_error("Engine is stopped.");
+
+            queue.push_back(Task{ std::move(job), token, std::move(promise) });
+        }
+
+        cv.notify_one();
+
+        return Job_Handle(std::move(token), std::move(future), hook);
+    }
+
+    void Engine::shutdown() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (stopping)
+                return;
+
+            stopping = true;
+
+            /* running transfers are interrupted, jobs those are not started yet are completed as canceled */
+            for (auto& token : running)
+                token.cancel();
+
+            for (auto& task : queue)
+                task.token.cancel();
+
+            for (auto& [key, flight] : flights)
+            {
+                for (auto& task : flight.followers)
+                    task.token.cancel();
+            }
+        }
+
+        cv.notify_all();
+
+        for (auto& worker : workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+
+    Engine& Engine::shared()
+    {
+        static Engine engine;
+        return engine;
+    }
+
+    void Engine::run() noexcept
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]{ return stopping || !queue.empty(); });
+
+            if (queue.empty())
+                return;
+
+            auto task = std::move(queue.front());
+            queue.pop_front();
+
+            auto key = flight_key(task.job);
+
+            if (!key.empty())
+            {
+                auto it = flights.find(key);
+
+                /* the same transfer is running, its result is shared */
+                if (it != flights.end())
+                {
+                    it->second.followers.push_back(std::move(task));
+                    continue;
+                }
+
+                flights[key];
+            }
+
+            auto it = running.insert(running.end(), task.token);
+            lock.unlock();
+
+            auto result = execute(task);
+
+            lock.lock();
+            running.erase(it);
+            lock.unlock();
+
+            if (!key.empty())
+                land(key, result);
+
+            finish(task, std::move(result));
+        }
+    }
+
+    void Engine::land(const std::string& key, const Job_Result& result) noexcept
+    {
+        std::vector<Task> followers;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = flights.find(key);
+            followers = std::move(it->second.followers);
+            flights.erase(it);
+
+            /* only the leader was canceled, the rest start over */
+            if (result.canceled && !followers.empty())
+            {
+                for (auto& task : followers)
+                {
+                    if (stopping)
+                        task.token.cancel();
+
+                    queue.push_front(std::move(task));
+                }
+
+                cv.notify_all();
+                return;
+            }
+        }
+
+        for (auto& task : followers)
+            finish(task, follow(task, result));
+    }
+
+    void Engine::reap() noexcept
+    {
+        std::vector<Task> canceled;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto take = [&](auto& tasks)
+            {
+                auto it = std::stable_partition(tasks.begin(), tasks.end(), [](const Task& task) { return !task.token.is_canceled(); });
+                std::move(it, tasks.end(), std::back_inserter(canceled));
+                tasks.erase(it, tasks.end());
+            };
+
+            /* followers do not wait for the leader to land */
+            for (auto& [key, flight] : flights)
+                take(flight.followers);
+
+            take(queue);
+        }
+
+        for (auto& task : canceled)
+        {
+            Job_Result result;
+            result.canceled = true;
+            finish(task, std::move(result));
+        }
+    }
+
+    void Engine::finish(Task& task, Job_Result result) noexcept
+    {
+        if (task.job.on_complete)
+        {
+            try
+            {
+                task.job.on_complete(result);
+            }
+            catch (...)
+            {
+                /* callback failures are not propagated to the engine */
+            }
+        }
+
+        task.promise.set_value(std::move(result));
+    }
+
+    Job_Result Engine::execute(Task& task) noexcept
+    {
+        Job_Result result;
+
+        if (task.token.is_canceled())
+        {
+            result.canceled = true;
+            return result;
+        }
+
+        try
+        {
+            Downloader downloader(std::move(task.job.progress));
+            downloader.set_cancel_token(task.token);
+            downloader.set_output_mode(task.job.output_mode);
+            downloader.set_cache(task.job.cache);
+            downloader.set_retry_policy(task.job.retry);
+            downloader.set_hedge_policy(task.job.hedge);
+
+            if (task.job.sink)
+            {
+                downloader.dowload(task.job.url, *task.job.sink);
+            }
+            else
+            {
+                result.path = downloader.dowload(task.job.url,
+                                                 task.job.directory,
+                                                 task.job.file_name,
+                                                 task.job.rewrite);
+            }
+        }
+        catch (...)
+        {
+            /* a token canceled after the transfer is over does not spoil the result */
+            result.error = std::current_exception();
+            result.canceled = task.token.is_canceled();
+        }
+
+        return result;
+    }
+
+    Job_Result Engine::follow(Task& task, const Job_Result& leader) noexcept
+    {
+        Job_Result result;
+
+        if (task.token.is_canceled())
+        {
+            result.canceled = true;
+            return result;
+        }
+
+        /* the same request would fail the same way */
+        if (leader.error)
+        {
+            result.error = leader.error;
+            return result;
+        }
+
+        try
+        {
+            auto info = Downloader::create_request_info(task.job.url);
+            auto directory = task.job.directory.empty() ? "." : task.job.directory;
+            auto name = task.job.file_name.empty() ? std::filesystem::path(info.file_name) : task.job.file_name.filename();
+            auto path = task.job.rewrite ? directory / name : Name_Allocator::shared().claim(directory, name);
+
+            std::error_code ec;
+
+            if (!std::filesystem::equivalent(leader.path, path, ec))
+            {
+                std::filesystem::remove(path);
+                std::filesystem::create_hard_link(leader.path, path, ec);
+
+                /* other file system */
+                if (ec)
+                    std::filesystem::copy_file(leader.path, path, std::filesystem::copy_options::overwrite_existing);
+            }
+
+            result.path = path;
+        }
+        catch (...)
+        {
+            result.error = std::current_exception();
+        }
+
+        return result;
+    }
+
+    std::string Engine::flight_key(const Job& job)
+    {
+        /* content for a sink is not kept anywhere to be shared */
+        if (job.sink)
+            return std::string();
+
+        try
+        {
+            auto info = Downloader::create_request_info(job.url);
+
+            /* scheme and host are case insensitive, the path is not */
+            std::string key = info.protocol.empty() ? "http" : info.protocol;
+            key += "://";
+            key += info.host;
+            str_tolower(key);
+            key += ':';
+            key += std::to_string(info.port);
+            key += '/';
+            key += info.url;
+            return key;
+        }
+        catch (const std::exception&)
+        {
+            /* the download reports the problem */
+            return std::string();
+        }
+    }
+}
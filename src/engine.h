@@ -0,0 +1,138 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "cancel.h"
+#include "hedge.h"
+#include "iprogress.h"
+#include "isink.h"
+#include "retry.h"
+#include "sinks.h"
+
+/*
+ * Asynchronous download API.
+ *
+ * Jobs are submitted to an engine, executed by its worker threads and
+ * completed through a future and/or a callback. Every job gets its own
+ * cancellation handle.
+ *
+ * Jobs for the same URL which run at the same time share one transfer:
+ * the first one downloads, the others wait without taking a worker and get
+ * a hard link (or a copy) of the result at their own destinations.
+*/
+
+namespace http
+{
+    struct Engine_Hook;
+
+    struct Job_Result
+    {
+        std::filesystem::path path;
+        std::exception_ptr error;
+        bool canceled = false;
+    };
+
+    using completion_t = std::function<void(const Job_Result&)>;
+
+    struct Job
+    {
+        std::string url;
+        std::filesystem::path directory;
+        std::filesystem::path file_name;
+        bool rewrite = false;
+        Output_Mode output_mode = Output_Mode::stream;
+        std::shared_ptr<Http_Cache> cache;
+        Retry_Policy retry;
+        Hedge_Policy hedge;
+        isink_ptr_t sink;
+        ipgrogress_ptr_t progress;
+        completion_t on_complete;
+    };
+
+    class Job_Handle
+    {
+    public:
+        Job_Handle() = default;
+
+        void cancel() noexcept;
+        bool is_canceled() const noexcept;
+        bool valid() const noexcept;
+
+        void wait() const;
+        const Job_Result& get() const;
+
+    private:
+        friend class Engine;
+
+        Job_Handle(Cancel_Token t, std::shared_future<Job_Result> f, std::shared_ptr<Engine_Hook> h) noexcept;
+
+    private:
+        std::optional<Cancel_Token> token;
+        std::shared_future<Job_Result> result;
+        std::shared_ptr<Engine_Hook> hook;      /* completes waiting jobs at once */
+    };
+
+    class Engine
+    {
+    public:
+        explicit Engine(size_t threads = 0);
+        ~Engine();
+
+        Engine(const Engine&) = delete;
+        Engine& operator=(const Engine&) = delete;
+
+        Job_Handle submit(Job job);
+        void shutdown() noexcept;
+
+        static Engine& shared();
+
+    private:
+        friend class Job_Handle;
+
+        struct Task
+        {
+            Job job;
+            Cancel_Token token;
+            std::promise<Job_Result> promise;
+        };
+
+        struct Flight
+        {
+            std::vector<Task> followers;
+        };
+
+        void run() noexcept;
+        void land(const std::string& key, const Job_Result& result) noexcept;
+        void reap() noexcept;
+        static void finish(Task& task, Job_Result result) noexcept;
+        static Job_Result execute(Task& task) noexcept;
+        static Job_Result follow(Task& task, const Job_Result& leader) noexcept;
+        static std::string flight_key(const Job& job);
+
+    private:
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Task> queue;
+        std::unordered_map<std::string, Flight> flights;     /* by normalized URL */
+        std::list<Cancel_Token> running;
+        std::vector<std::thread> workers;
+        std::shared_ptr<Engine_Hook> hook;
+        bool stopping = false;
+    };
+}
+
+#endif // ENGINE_H
@@ -0,0 +1,675 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "buffers.h"
+#include "h2.h"
+
+#define H2_PREFACE                      "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_FRAME_HEADER_SIZE            9
+#define H2_DEFAULT_WINDOW               65535
+#define H2_MIN_FRAME_SIZE               16384
+#define H2_FRAME_SIZE_LIMIT             16777215
+
+/* tuned for bulk download: the sender is rarely stopped by a window */
+#define H2_STREAM_WINDOW                (16 * 1024 * 1024)
+#define H2_CONNECTION_WINDOW            (64 * 1024 * 1024)
+#define H2_MAX_FRAME_SIZE               (256 * 1024)
+#define H2_MAX_HEADER_BLOCK             (1024 * 1024)
+
+#define H2_FRAME_DATA                   0x0
+#define H2_FRAME_HEADERS                0x1
+#define H2_FRAME_RST_STREAM             0x3
+#define H2_FRAME_SETTINGS               0x4
+#define H2_FRAME_PUSH_PROMISE           0x5
+#define H2_FRAME_PING                   0x6
+#define H2_FRAME_GOAWAY                 0x7
+#define H2_FRAME_WINDOW_UPDATE          0x8
+#define H2_FRAME_CONTINUATION           0x9
+
+#define H2_FLAG_ACK                     0x1
+#define H2_FLAG_END_STREAM              0x1
+#define H2_FLAG_END_HEADERS             0x4
+#define H2_FLAG_PADDED                  0x8
+#define H2_FLAG_PRIORITY                0x20
+
+#define H2_SETTINGS_ENABLE_PUSH         0x2
+#define H2_SETTINGS_MAX_CONCURRENT      0x3
+#define H2_SETTINGS_INITIAL_WINDOW      0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE      0x5
+
+#define H2_NO_ERROR                     0x0
+#define H2_REFUSED_STREAM               0x7
+#define H2_CANCEL                       0x8
+
+namespace http
+{
+    namespace
+    {
+        void put_uint(std::string& out, std::uint32_t value, unsigned bytes)
+        {
+            while (bytes--)
+                out.push_back(static_cast<char>((value >> (bytes * 8)) & 0xff));
+        }
+
+        std::uint32_t get_uint(const char* p, unsigned bytes) noexcept
+        {
+            std::uint32_t value = 0;
+
+            while (bytes--)
+                value = (value << 8) | static_cast<std::uint8_t>(*p++);
+
+            return value;
+        }
+
+        void append_frame(std::string& out, std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, std::string_view payload)
+        {
+            put_uint(out, payload.size(), 3);
+            out.push_back(static_cast<char>(type));
+            out.push_back(static_cast<char>(flags));
+            put_uint(out, stream_id & 0x7fffffff, 4);
+            out.append(payload);
+        }
+
+        void append_setting(std::string& out, std::uint16_t id, std::uint32_t value)
+        {
+            put_uint(out, id, 2);
+            put_uint(out, value, 4);
+        }
+
+        [[noreturn]] void protocol_error(const char* what)
+        {
+            std::string msg = "Invalid server response: ";
+            msg += what;
+            throw std::runtime_error(msg);
+        }
+    }
+
+    H2_Connection::H2_Connection() noexcept :
+        connection(progress)
+    {
+
+    }
+
+    H2_Connection::~H2_Connection()
+    {
+        if (!open)
+            return;
+
+        try
+        {
+            std::string payload;
+            put_uint(payload, 0, 4);
+            put_uint(payload, H2_NO_ERROR, 4);
+            send_frame(H2_FRAME_GOAWAY, 0, 0, payload);
+        }
+        catch (const std::exception&)
+        {
+            /* the server may be gone already */
+        }
+    }
+
+    void H2_Connection::set_receive_timeout(std::chrono::seconds timeout) noexcept
+    {
+        connection.set_receive_timeout(timeout);
+    }
+
+    void H2_Connection::set_cancel_token(const Cancel_Token& token) noexcept
+    {
+        connection.set_cancel_token(token);
+    }
+
+    void H2_Connection::connect(const std::string& host, std::uint16_t port)
+    {
+        authority = host;
+
+        if (port != 80)
+        {
+            authority += ':';
+            authority += std::to_string(port);
+        }
+
+        /* not from the pool, idle connections there speak HTTP/1.1 */
+        connection.connect(host, resolve_name(host), port);
+
+        std::string settings;
+        append_setting(settings, H2_SETTINGS_ENABLE_PUSH, 0);
+        append_setting(settings, H2_SETTINGS_INITIAL_WINDOW, H2_STREAM_WINDOW);
+        append_setting(settings, H2_SETTINGS_MAX_FRAME_SIZE, H2_MAX_FRAME_SIZE);
+
+        std::string increment;
+        put_uint(increment, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW, 4);
+
+        std::string out = H2_PREFACE;
+        append_frame(out, H2_FRAME_SETTINGS, 0, 0, settings);
+        append_frame(out, H2_FRAME_WINDOW_UPDATE, 0, 0, increment);
+        connection.send_request(out);
+
+        open = true;
+    }
+
+    void H2_Connection::fetch(std::vector<H2_Request>& requests)
+    {
+        size_t next = 0;
+        std::string reason = "Connection is closed.";
+
+        try
+        {
+            /* the stream limit is not known until the server's settings arrive */
+            while (open && !peer_settings)
+                process_frame();
+
+            while (open)
+            {
+                while (next < requests.size() && streams.size() < max_streams && !going_away)
+                    open_stream(requests[next++]);
+
+                if (streams.empty())
+                    break;
+
+                process_frame();
+            }
+        }
+        catch (const std::exception& e)
+        {
+            /* connection is unusable, requests in flight are lost */
+            open = false;
+            reason = e.what();
+
+            for (auto& [id, stream] : streams)
+            {
+                stream.request->error = e.what();
+                stream.request->retryable = true;
+            }
+
+            streams.clear();
+        }
+
+        if (going_away)
+            open = false;
+
+        for (; next < requests.size(); ++next)
+        {
+            requests[next].status_code = 0;
+            requests[next].error = reason;
+            requests[next].retryable = true;
+        }
+    }
+
+    bool H2_Connection::is_open() const noexcept
+    {
+        return open && !going_away;
+    }
+
+    void H2_Connection::open_stream(H2_Request& request)
+    {
+        request.status_code = 0;
+        request.headers.clear();
+        request.error.clear();
+        request.retryable = false;
+
+        auto stream_id = next_stream_id;
+        next_stream_id += 2;
+
+        std::string block;
+        Hpack_Encoder::encode(block, {
+            { ":method", "GET" },
+            { ":scheme", "http" },
+            { ":authority", authority },
+            { ":path", request.path },
+            { "user-agent", "downloader" },
+            { "accept", "*/*" }
+        });
+
+        /* GET has no body, so the stream is half-closed right away */
+        std::string out;
+        size_t pos = 0;
+
+        do
+        {
+            auto len = std::min<size_t>(block.size() - pos, max_frame_size);
+            std::uint8_t flags = pos + len == block.size() ? H2_FLAG_END_HEADERS : 0;
+
+            if (pos == 0)
+                append_frame(out, H2_FRAME_HEADERS, flags | H2_FLAG_END_STREAM, stream_id, std::string_view(block).substr(pos, len));
+            else
+                append_frame(out, H2_FRAME_CONTINUATION, flags, stream_id, std::string_view(block).substr(pos, len));
+
+            pos += len;
+        }
+        while (pos < block.size());
+
+        connection.send_request(out);
+
+        Stream stream;
+        stream.request = &request;
+        streams[stream_id] = stream;
+    }
+
+    void H2_Connection::process_frame()
+    {
+        auto frame = read_frame_header();
+
+        if (frame.length > H2_MAX_FRAME_SIZE)
+            protocol_error("Frame is too large.");
+
+        /* a header block is not interleaved with other frames */
+        if (continued_stream && frame.type != H2_FRAME_CONTINUATION)
+            protocol_error("Header block is interrupted.");
+
+        switch (frame.type)
+        {
+            case H2_FRAME_DATA:
+            {
+                on_data(frame);
+                break;
+            }
+
+            case H2_FRAME_HEADERS:
+            {
+                on_headers(frame, read_payload(frame.length));
+                break;
+            }
+
+            case H2_FRAME_CONTINUATION:
+            {
+                auto payload = read_payload(frame.length);
+
+                if (frame.stream_id != continued_stream)
+                    protocol_error("Unexpected CONTINUATION frame.");
+
+                if (header_block.size() + payload.size() > H2_MAX_HEADER_BLOCK)
+                    protocol_error("Header block is too large.");
+
+                header_block += payload;
+
+                if (frame.flags & H2_FLAG_END_HEADERS)
+                {
+                    continued_stream = 0;
+                    on_header_block(frame.stream_id, continued_end_stream);
+                }
+
+                break;
+            }
+
+            case H2_FRAME_SETTINGS:
+            {
+                on_settings(frame, read_payload(frame.length));
+                break;
+            }
+
+            case H2_FRAME_PING:
+            {
+                auto payload = read_payload(frame.length);
+
+                if (!(frame.flags & H2_FLAG_ACK))
+                    send_frame(H2_FRAME_PING, H2_FLAG_ACK, 0, payload);
+
+                break;
+            }
+
+            case H2_FRAME_GOAWAY:
+            {
+                on_goaway(read_payload(frame.length));
+                break;
+            }
+
+            case H2_FRAME_RST_STREAM:
+            {
+                auto payload = read_payload(frame.length);
+
+                if (payload.size() != 4)
+                    protocol_error("Invalid RST_STREAM frame.");
+
+                auto code = get_uint(payload.data(), 4);
+                std::string msg = "Stream is reset by server, error code ";
+                msg += std::to_string(code);
+                msg += '.';
+
+                /* the server did not process the request at all */
+                finish_stream(frame.stream_id, msg, code == H2_REFUSED_STREAM);
+                break;
+            }
+
+            case H2_FRAME_PUSH_PROMISE:
+            {
+                protocol_error("Server push is disabled.");
+            }
+
+            default:
+            {
+                /* PRIORITY, WINDOW_UPDATE (nothing is sent in DATA) and unknown types */
+                read_payload(frame.length);
+                break;
+            }
+        }
+    }
+
+    void H2_Connection::on_data(const Frame_Header& frame)
+    {
+        size_t len = frame.length;
+        size_t padding = 0;
+
+        if (frame.flags & H2_FLAG_PADDED)
+        {
+            if (len < 1)
+                protocol_error("Invalid DATA frame.");
+
+            char pad_length;
+            read_exact(&pad_length, 1);
+            padding = static_cast<std::uint8_t>(pad_length);
+
+            if (padding > --len)
+                protocol_error("Invalid DATA frame.");
+
+            len -= padding;
+        }
+
+        auto it = streams.find(frame.stream_id);
+
+        /* body of an unsuccessful response is dropped */
+        ISink* sink = it != streams.end() && it->second.request->status_code == 200 ? it->second.request->sink : nullptr;
+        std::string error;
+
+        auto block = Buffer_Pool::shared().acquire();
+
+        while (len)
+        {
+            auto n = connection.read(block.data(), std::min(len, block.size()));
+
+            if (sink)
+            {
+                try
+                {
+                    sink->write(block.data(), n);
+                }
+                catch (const std::exception& e)
+                {
+                    error = e.what();
+                    sink = nullptr;
+                }
+            }
+
+            len -= n;
+        }
+
+        while (padding)
+            padding -= connection.read(block.data(), std::min(padding, block.size()));
+
+        if (!error.empty())
+        {
+            std::string payload;
+            put_uint(payload, H2_CANCEL, 4);
+            send_frame(H2_FRAME_RST_STREAM, 0, frame.stream_id, payload);
+            finish_stream(frame.stream_id, error);
+        }
+        else if (frame.flags & H2_FLAG_END_STREAM)
+        {
+            finish_stream(frame.stream_id);
+        }
+
+        consume(frame.stream_id, frame.length);
+    }
+
+    void H2_Connection::on_headers(const Frame_Header& frame, std::string payload)
+    {
+        size_t pos = 0;
+        size_t padding = 0;
+
+        if (frame.flags & H2_FLAG_PADDED)
+        {
+            if (payload.empty())
+                protocol_error("Invalid HEADERS frame.");
+
+            padding = static_cast<std::uint8_t>(payload[0]);
+            pos = 1;
+        }
+
+        /* stream dependency and weight */
+        if (frame.flags & H2_FLAG_PRIORITY)
+            pos += 5;
+
+        if (pos + padding > payload.size())
+            protocol_error("Invalid HEADERS frame.");
+
+        header_block.assign(payload, pos, payload.size() - pos - padding);
+
+        bool end_stream = frame.flags & H2_FLAG_END_STREAM;
+
+        if (frame.flags & H2_FLAG_END_HEADERS)
+        {
+            on_header_block(frame.stream_id, end_stream);
+        }
+        else
+        {
+            continued_stream = frame.stream_id;
+            continued_end_stream = end_stream;
+        }
+    }
+
+    void H2_Connection::on_header_block(std::uint32_t stream_id, bool end_stream)
+    {
+        /* decoded even for unknown streams, the table is shared by all */
+        auto list = decoder.decode(header_block);
+        header_block.clear();
+
+        auto it = streams.find(stream_id);
+
+        if (it == streams.end())
+            return;
+
+        auto& request = *it->second.request;
+
+        /* trailers follow the final response headers */
+        if (request.status_code == 0)
+        {
+            unsigned status_code = 0;
+            header_list_t headers;
+
+            for (auto& [name, value] : list)
+            {
+                if (name == ":status")
+                    status_code = std::strtoul(value.c_str(), nullptr, 10);
+                else if (!name.empty() && name[0] != ':')
+                    headers.insert(std::pair{ std::move(name), std::move(value) });
+            }
+
+            if (status_code < 100)
+            {
+                finish_stream(stream_id, "Invalid server response: Status is missing.");
+                return;
+            }
+
+            /* informational response, the final one follows */
+            if (status_code < 200)
+                return;
+
+            request.status_code = status_code;
+            request.headers = std::move(headers);
+
+            auto length = request.headers.find("content-length");
+
+            if (status_code == 200 && length != request.headers.end())
+            {
+                try
+                {
+                    request.sink->reserve(std::strtoull(length->second.c_str(), nullptr, 10));
+                }
+                catch (const std::exception& e)
+                {
+                    std::string payload;
+                    put_uint(payload, H2_CANCEL, 4);
+                    send_frame(H2_FRAME_RST_STREAM, 0, stream_id, payload);
+                    finish_stream(stream_id, e.what());
+                    return;
+                }
+            }
+        }
+
+        if (end_stream)
+            finish_stream(stream_id);
+    }
+
+    void H2_Connection::on_settings(const Frame_Header& frame, const std::string& payload)
+    {
+        if (frame.flags & H2_FLAG_ACK)
+            return;
+
+        if (payload.size() % 6)
+            protocol_error("Invalid SETTINGS frame.");
+
+        peer_settings = true;
+
+        for (size_t pos = 0; pos < payload.size(); pos += 6)
+        {
+            auto id = get_uint(payload.data() + pos, 2);
+            auto value = get_uint(payload.data() + pos + 2, 4);
+
+            switch (id)
+            {
+                case H2_SETTINGS_MAX_CONCURRENT:
+                    max_streams = std::max<std::uint32_t>(value, 1);
+                    break;
+
+                case H2_SETTINGS_MAX_FRAME_SIZE:
+                    /* RFC 9113, 6.5.2 */
+                    if (value < H2_MIN_FRAME_SIZE || value > H2_FRAME_SIZE_LIMIT)
+                        protocol_error("Invalid SETTINGS_MAX_FRAME_SIZE.");
+
+                    max_frame_size = value;
+                    break;
+
+                default:
+                    /* the encoder does not use the dynamic table, nothing is sent in DATA */
+                    break;
+            }
+        }
+
+        send_frame(H2_FRAME_SETTINGS, H2_FLAG_ACK, 0, std::string());
+    }
+
+    void H2_Connection::on_goaway(const std::string& payload)
+    {
+        if (payload.size() < 8)
+            protocol_error("Invalid GOAWAY frame.");
+
+        auto last_stream_id = get_uint(payload.data(), 4) & 0x7fffffff;
+        going_away = true;
+
+        /* streams above the last one were not processed and may be retried */
+        std::vector<std::uint32_t> refused;
+
+        for (const auto& [id, stream] : streams)
+        {
+            if (id > last_stream_id)
+                refused.push_back(id);
+        }
+
+        for (auto id : refused)
+            finish_stream(id, "Request is refused by server (GOAWAY).", true);
+    }
+
+    void H2_Connection::finish_stream(std::uint32_t stream_id, const std::string& error, bool retryable)
+    {
+        auto it = streams.find(stream_id);
+
+        if (it == streams.end())
+            return;
+
+        auto& request = *it->second.request;
+        streams.erase(it);
+
+        if (!error.empty())
+        {
+            request.error = error;
+            request.retryable = retryable;
+            return;
+        }
+
+        if (request.status_code != 200)
+        {
+            Status_Line status{ "HTTP/2", request.status_code, std::string() };
+            request.error = unsuccessful_status_message(status, request.headers);
+            return;
+        }
+
+        try
+        {
+            request.sink->finish();
+        }
+        catch (const std::exception& e)
+        {
+            request.error = e.what();
+        }
+    }
+
+    void H2_Connection::consume(std::uint32_t stream_id, size_t len)
+    {
+        /* the window is given back in large steps, not frame by frame */
+        connection_unacknowledged += len;
+
+        if (connection_unacknowledged >= H2_CONNECTION_WINDOW / 2)
+        {
+            send_window_update(0, connection_unacknowledged);
+            connection_unacknowledged = 0;
+        }
+
+        auto it = streams.find(stream_id);
+
+        if (it == streams.end())
+            return;
+
+        it->second.unacknowledged += len;
+
+        if (it->second.unacknowledged >= H2_STREAM_WINDOW / 2)
+        {
+            send_window_update(stream_id, it->second.unacknowledged);
+            it->second.unacknowledged = 0;
+        }
+    }
+
+    void H2_Connection::send_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::string& payload)
+    {
+        std::string out;
+        append_frame(out, type, flags, stream_id, payload);
+        connection.send_request(out);
+    }
+
+    void H2_Connection::send_window_update(std::uint32_t stream_id, std::uint32_t increment)
+    {
+        std::string payload;
+        put_uint(payload, increment & 0x7fffffff, 4);
+        send_frame(H2_FRAME_WINDOW_UPDATE, 0, stream_id, payload);
+    }
+
+    H2_Connection::Frame_Header H2_Connection::read_frame_header()
+    {
+        char buff[H2_FRAME_HEADER_SIZE];
+        read_exact(buff, sizeof(buff));
+
+        Frame_Header frame;
+        frame.length = get_uint(buff, 3);
+        frame.type = static_cast<std::uint8_t>(buff[3]);
+        frame.flags = static_cast<std::uint8_t>(buff[4]);
+        frame.stream_id = get_uint(buff + 5, 4) & 0x7fffffff;
+
+        return frame;
+    }
+
+    std::string H2_Connection::read_payload(size_t len)
+    {
+        std::string payload(len, '\0');
+        read_exact(payload.data(), len);
+        return payload;
+    }
+
+    void H2_Connection::read_exact(char* buff, size_t len)
+    {
+        while (len)
+        {
+            auto n = connection.read(buff, len);
+            buff += n;
+            len -= n;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef H2_H
+#define H2_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cancel.h"
+#include "connection.h"
+#include "hpack.h"
+#include "isink.h"
+#include "protocol.h"
+
+/*
+ * RFC 9113 - "HTTP/2"
+ * https://www.ietf.org/rfc/rfc9113.html
+ *
+ * Cleartext HTTP/2 with prior knowledge (no Upgrade): many GET requests are
+ * multiplexed as streams over one TCP connection.
+*/
+
+namespace http
+{
+    struct H2_Request
+    {
+        std::string path;               /* origin form: "/dir/file" */
+        ISink* sink = nullptr;
+
+        /* outcome */
+        unsigned status_code = 0;       /* 0 - no response */
+        header_list_t headers;
+        std::string error;              /* empty - content is in the sink */
+        bool retryable = false;         /* lost connection, refused or unprocessed stream */
+    };
+
+    class H2_Connection
+    {
+    public:
+        H2_Connection() noexcept;
+        ~H2_Connection();
+
+        void set_receive_timeout(std::chrono::seconds timeout) noexcept;
+        void set_cancel_token(const Cancel_Token& token) noexcept;
+
+        /* TCP connection, preface and settings */
+        void connect(const std::string& host, std::uint16_t port);
+
+        /*
+         * Runs the requests, as many at once as the server allows. Errors are
+         * reported per request; after a connection failure or GOAWAY the
+         * connection is closed and the rest of the requests fail.
+        */
+        void fetch(std::vector<H2_Request>& requests);
+
+        bool is_open() const noexcept;
+
+    private:
+        struct Stream
+        {
+            H2_Request* request = nullptr;
+            size_t unacknowledged = 0;  /* received bytes not returned to the window yet */
+        };
+
+        struct Frame_Header
+        {
+            std::uint32_t length;
+            std::uint8_t type;
+            std::uint8_t flags;
+            std::uint32_t stream_id;
+        };
+
+        void open_stream(H2_Request& request);
+        void process_frame();
+        void on_data(const Frame_Header& frame);
+        void on_headers(const Frame_Header& frame, std::string payload);
+        void on_header_block(std::uint32_t stream_id, bool end_stream);
+        void on_settings(const Frame_Header& frame, const std::string& payload);
+        void on_goaway(const std::string& payload);
+        void finish_stream(std::uint32_t stream_id, const std::string& error = std::string(), bool retryable = false);
+        void consume(std::uint32_t stream_id, size_t len);
+
+        void send_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::string& payload);
+        void send_window_update(std::uint32_t stream_id, std::uint32_t increment);
+        Frame_Header read_frame_header();
+        std::string read_payload(size_t len);
+        void read_exact(char* buff, size_t len);
+
+    private:
+        ipgrogress_ptr_t progress;
+        Connection connection;
+        std::string authority;
+        Hpack_Decoder decoder;
+        std::unordered_map<std::uint32_t, Stream> streams;
+        std::uint32_t next_stream_id = 1;
+        std::uint32_t max_streams = 100;
+        std::uint32_t max_frame_size = 16384;    /* peer's limit for what we send */
+        size_t connection_unacknowledged = 0;
+
+        /* header block which is continued by CONTINUATION frames */
+        std::uint32_t continued_stream = 0;
+        bool continued_end_stream = false;
+        std::string header_block;
+
+        bool open = false;
+        bool peer_settings = false;
+        bool going_away = false;
+    };
+}
+
+#endif // H2_H
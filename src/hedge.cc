@@ -0,0 +1,325 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <stdexcept>
+
+#include "hedge.h"
+#include "isink.h"
+
+#define HOST_STATS_MAX_SAMPLES      32
+#define HOST_STATS_MIN_SAMPLE_SIZE  65536
+#define HEDGE_MONITOR_INTERVAL_MS   100
+#define HEDGE_COPY_BUFF_SIZE        65536
+#define HEDGE_MAX_SPOOL             (64 * 1024 * 1024)
+
+namespace http
+{
+    namespace
+    {
+        /* receives the hedged range into the spool file, stops at its capacity */
+        class Spool_Sink : public ISink
+        {
+        public:
+            Spool_Sink(int f, size_t cap) noexcept : fd(f), capacity(cap) {}
+
+            void reserve(size_t) noexcept override {}
+
+            void write(const char* data, size_t len) override
+            {
+                len = std::min(len, capacity - size);
+
+                while (len)
+                {
+                    auto written = ::write(fd, data, len);
+
+                    if (written < 0)
+                    {
+                        if (errno == EINTR)
+                            continue;
+
+                        throw std::runtime_error("Unable to spool hedged content.");
+                    }
+
+                    data += written;
+                    len -= written;
+                    size += written;
+                }
+
+                if (full())
+                    throw std::runtime_error("Hedge spool is full.");
+            }
+
+            void finish() noexcept override {}
+
+            bool full() const noexcept { return size == capacity; }
+
+        public:
+            size_t size = 0;
+
+        private:
+            int fd;
+            size_t capacity;
+        };
+    }
+
+    void Host_Stats::record(const std::string& host, size_t bytes, std::chrono::steady_clock::duration elapsed)
+    {
+        auto seconds = std::chrono::duration<double>(elapsed).count();
+
+        /* latency dominates small transfers */
+        if (bytes < HOST_STATS_MIN_SAMPLE_SIZE || seconds <= 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& list = samples[host];
+        list.push_back(bytes / seconds);
+
+        if (list.size() > HOST_STATS_MAX_SAMPLES)
+            list.pop_front();
+    }
+
+    std::optional<double> Host_Stats::median(const std::string& host, size_t min_samples)
+    {
+        std::vector<double> values;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = samples.find(host);
+
+            if (it == samples.end() || it->second.size() < std::max<size_t>(min_samples, 1))
+                return std::nullopt;
+
+            values.assign(it->second.begin(), it->second.end());
+        }
+
+        auto middle = values.begin() + values.size() / 2;
+        std::nth_element(values.begin(), middle, values.end());
+
+        return *middle;
+    }
+
+    Host_Stats& Host_Stats::shared()
+    {
+        static Host_Stats stats;
+        return stats;
+    }
+
+    Hedge::Hedge(const Hedge_Policy& pol,
+                 const std::string& h,
+                 std::uint16_t p,
+                 request_builder_t builder,
+                 Connection& prim,
+                 size_t b,
+                 size_t e,
+                 std::chrono::seconds timeout,
+                 const Cancel_Token& t) :
+        policy(pol),
+        host(h),
+        port(p),
+        build_request(std::move(builder)),
+        primary(prim),
+        base(b),
+        end(e),
+        receive_timeout(timeout),
+        token(t)
+    {
+        thread = std::thread(&Hedge::monitor, this);
+    }
+
+    Hedge::~Hedge()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+
+            if (second)
+                second->abort();
+        }
+
+        cv.notify_all();
+
+        if (thread.joinable())
+            thread.join();
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    bool Hedge::won() const noexcept
+    {
+        return victory;
+    }
+
+    size_t Hedge::complete(ISink& sink, size_t position, ipgrogress_ptr_t& progress)
+    {
+        char buff[HEDGE_COPY_BUFF_SIZE];
+
+        while (position < hedge_end)
+        {
+            auto len = std::min(sizeof(buff), end - position);
+            auto bytes_read = ::pread(fd, buff, len, position - hedge_start);
+
+            if (bytes_read <= 0)
+            {
+                if (bytes_read < 0 && errno == EINTR)
+                    continue;
+
+                throw std::runtime_error("Unable to read hedged content.");
+            }
+
+            sink.write(buff, bytes_read);
+            position += bytes_read;
+
+            if (progress)
+            {
+                progress->add_progress(bytes_read);
+            }
+        }
+
+        /* the rest beyond the spool is requested again by the caller */
+        if (position < end)
+            return position;
+
+        if (progress)
+        {
+            progress->stop();
+        }
+
+        sink.finish();
+        return position;
+    }
+
+    void Hedge::monitor() noexcept
+    {
+        using clock_t = std::chrono::steady_clock;
+
+        std::deque<std::pair<clock_t::time_point, size_t>> history;
+        auto started = clock_t::now();
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!stopping)
+        {
+            cv.wait_for(lock, std::chrono::milliseconds(HEDGE_MONITOR_INTERVAL_MS));
+
+            if (stopping)
+                return;
+
+            auto now = clock_t::now();
+            auto received = primary.received();
+            history.emplace_back(now, received);
+
+            while (now - history.front().first > policy.observe)
+                history.pop_front();
+
+            if (now - started < policy.observe)
+                continue;
+
+            auto position = base + received;
+
+            if (position >= end || end - position < policy.min_remaining)
+                continue;
+
+            auto median = Host_Stats::shared().median(host, policy.min_samples);
+
+            if (!median)
+                continue;
+
+            auto seconds = std::chrono::duration<double>(now - history.front().first).count();
+            auto speed = seconds > 0 ? (received - history.front().second) / seconds : 0;
+
+            if (speed < *median * policy.ratio)
+            {
+                lock.unlock();
+                race(position);
+                return;
+            }
+        }
+    }
+
+    void Hedge::race(size_t from) noexcept
+    {
+        try
+        {
+            /* prefer another address of the same host */
+            auto addrs = resolve_names(host);
+            auto addr = addrs.front();
+
+            for (const auto& a : addrs)
+            {
+                if (a.s_addr != primary.peer().s_addr)
+                {
+                    addr = a;
+                    break;
+                }
+            }
+
+            auto tmpl = (std::filesystem::temp_directory_path() / "downloader-hedge-XXXXXX").string();
+            fd = ::mkostemp(tmpl.data(), O_CLOEXEC);
+
+            if (fd < 0)
+                return;
+
+            ::unlink(tmpl.c_str());
+
+            ipgrogress_ptr_t none;
+            Connection connection(none);
+            connection.set_cancel_token(token);
+            connection.set_secure(primary.is_secure());
+            connection.set_receive_timeout(receive_timeout);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (stopping)
+                    return;
+
+                second = &connection;
+            }
+
+            try
+            {
+                connection.connect(host, addr, port);
+                connection.send_request(build_request(from));
+
+                auto status = connection.retrieve_http_status_line();
+                auto headers = connection.retrieve_headers();
+                if (status.status_code == 206 && content_range_start(headers) == from)
+                {
+                    Spool_Sink spool(fd, std::min<size_t>(end - from, HEDGE_MAX_SPOOL));
+
+                    try
+                    {
+                        connection.download(spool, headers);
+                    }
+                    catch (...)
+                    {
+                        if (!spool.full())
+                            throw;
+                    }
+
+                    hedge_start = from;
+                    hedge_end = from + spool.size;
+                    victory = true;
+                    primary.abort();
+                }
+            }
+            catch (...)
+            {
+                /* hedge failure leaves the primary transfer alone */
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            second = nullptr;
+        }
+        catch (...)
+        {
+
+        }
+    }
+}
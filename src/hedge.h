@@ -0,0 +1,103 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "cancel.h"
+#include "connection.h"
+
+namespace http
+{
+    /*
+     * A transfer which is much slower than recent transfers from the same
+     * host gets a second connection for the remaining byte range. The one
+     * finishing first wins.
+    */
+    struct Hedge_Policy
+    {
+        bool enabled = false;
+        double ratio = 0.3;                                 /* of host median speed */
+        std::chrono::milliseconds observe { 2000 };         /* speed measurement window */
+        size_t min_samples = 3;
+        size_t min_remaining = 1024 * 1024;
+    };
+
+    /* recent throughput of completed transfers per host */
+    class Host_Stats
+    {
+    public:
+        void record(const std::string& host, size_t bytes, std::chrono::steady_clock::duration elapsed);
+        std::optional<double> median(const std::string& host, size_t min_samples);
+
+        static Host_Stats& shared();
+
+    private:
+        std::mutex mutex;
+        std::unordered_map<std::string, std::deque<double>> samples;
+    };
+
+    /*
+     * Watches the primary connection and races a second one for the rest
+     * of the content. The hedge receives into an anonymous temporary file,
+     * at most HEDGE_MAX_SPOOL bytes; if it gets there first the primary is
+     * aborted and the caller copies the spooled part with complete() and
+     * requests the rest, if any, again.
+    */
+    class Hedge
+    {
+    public:
+        using request_builder_t = std::function<std::string(size_t from)>;
+
+    public:
+        Hedge(const Hedge_Policy& policy,
+              const std::string& host,
+              std::uint16_t port,
+              request_builder_t build_request,
+              Connection& primary,
+              size_t base,
+              size_t end,
+              std::chrono::seconds receive_timeout,
+              const Cancel_Token& token);
+        ~Hedge();
+
+        bool won() const noexcept;
+        /* returns the position reached, the content is finished at the end */
+        size_t complete(ISink& sink, size_t position, ipgrogress_ptr_t& progress);
+
+    private:
+        void monitor() noexcept;
+        void race(size_t from) noexcept;
+
+    private:
+        Hedge_Policy policy;
+        std::string host;
+        std::uint16_t port;
+        request_builder_t build_request;
+        Connection& primary;
+        size_t base;
+        size_t end;
+        std::chrono::seconds receive_timeout;
+        Cancel_Token token;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        Connection* second = nullptr;
+        std::atomic_bool victory = false;
+        size_t hedge_start = 0;
+        size_t hedge_end = 0;
+        int fd = -1;
+        std::thread thread;
+    };
+}
+
+#endif // HEDGE_H
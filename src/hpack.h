@@ -0,0 +1,57 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * RFC 7541 - "HPACK: Header Compression for HTTP/2"
+ * https://www.ietf.org/rfc/rfc7541.html
+*/
+
+namespace http
+{
+    using hpack_header_t = std::pair<std::string, std::string>;
+    using hpack_list_t = std::vector<hpack_header_t>;
+
+    class Hpack_Decoder
+    {
+    public:
+        explicit Hpack_Decoder(size_t max_table_size = 4096) noexcept;
+
+        /* decodes complete header block, the dynamic table is kept between blocks */
+        hpack_list_t decode(std::string_view block);
+
+    private:
+        const hpack_header_t& entry(size_t index) const;
+        void insert(hpack_header_t header);
+        void evict(size_t limit) noexcept;
+
+        static std::uint64_t read_integer(std::string_view block, size_t& pos, unsigned prefix_bits);
+        static std::string read_string(std::string_view block, size_t& pos);
+        static std::string huffman_decode(std::string_view data);
+
+    private:
+        std::deque<hpack_header_t> table;   /* newest first */
+        size_t table_size = 0;
+        size_t max_size;
+        size_t settings_max_size;
+    };
+
+    /* Only the static table is used, so there is no state to keep in sync with the peer */
+    class Hpack_Encoder
+    {
+    public:
+        static void encode(std::string& out, const hpack_list_t& headers);
+
+    private:
+        static void write_integer(std::string& out, std::uint8_t first, unsigned prefix_bits, std::uint64_t value);
+        static void write_string(std::string& out, std::string_view value);
+    };
+}
+
+#endif // HPACK_H
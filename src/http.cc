@@ -1,800 +1,550 @@
-#include <unistd.h>
-#include <sys/types.h>
-#include <netdb.h>
-#include <arpa/inet.h>
-
+#include <algorithm>
 #include <cstring>
 #include <climits>
 #include <stdexcept>
 #include <regex>
 #include <iostream>
-#include <fstream>
+#include <thread>
 
 #include "http.h"
+#include "names.h"
+#include "protocol.h"
 
-#define VALID_HTTP_URL_REGEX    "^(?:([A-Za-z]+)(?::\\/\\/))?(?:([A-Za-z0-9\\.\\-_]+)(?::([0-9]{1,5}))?)\\/((?:[A-Za-z0-9\\.\\-_%]*\\/)*([A-Za-z0-9\\.\\-_%]+)(?:\\?[A-Za-z0-9\\.\\-_=&,#%]*)?)$"
-#define DOWNLOAD_RCV_TIMEOUT_S  5
-#define MAX_FILE_NAME_TRYOUTS   UINT_MAX
-#define RCV_SMALL_BUFF_SIZE     64
-#define RCV_LARGE_BUFF_SIZE     1024
-#define RCV_CHUNK_BUFF_SIZE     4096
+#define VALID_HTTP_URL_REGEX    "^(?:([A-Za-z]+)(?::\\/\\/))?(?:([A-Za-z0-9\\.\\-_]+)(?::([0-9]{1,5}))?)\\/((?:[A-Za-z0-9\\.\\-_%]*\\/)*([A-Za-z0-9\\.\\-_%]*)(?:\\?[A-Za-z0-9\\.\\-_=&,#%]*)?)$"
+#define RETRY_SLEEP_SLICE_MS    100
 
 namespace http
 {
-    static void str_tolower(std::string& str)
-    {
-        std::transform(str.begin(), str.end(), str.begin(),
-            [](unsigned char c){ return std::tolower(c); });
-    }
-
     Downloader::Downloader(ipgrogress_ptr_t pr) noexcept :
         progress(std::move(pr))
     {
 
     }
 
-    void Downloader::dowload(const std::string& url,
-                             const std::filesystem::path& download_dir,
-                             const std::filesystem::path& file_name,
-                             bool rewrite)
+    std::filesystem::path Downloader::dowload(const std::string& url,
+                                              const std::filesystem::path& download_dir,
+                                              const std::filesystem::path& file_name,
+                                              bool rewrite)
     {
         auto info = create_request_info(url);
 
-        if (info.protocol != "http")
+        std::optional<Http_Cache::Entry> cached;
+        std::string conditions;
+
+        if (cache)
         {
-            std::string msg = "Unsupported protocol: ";
-            msg += info.protocol;
-            throw std::runtime_error(msg);
-        }
+            cached = cache->find(url);
 
-        auto request = create_get_request(info);
+            if (cached)
+            {
+                conditions = Http_Cache::conditional_headers(*cached);
+            }
+        }
 
-        Connection connection(progress);
-        connection.connect(info.host, info.port);
-        connection.send_request(request);
-        auto status = connection.retrieve_http_status_line();
+        std::filesystem::path path;
+        std::string key;
+        size_t resume_offset = 0;
+        std::string resume_validator;
 
-        if (status.status_code == 200)
+        if (journal)
         {
-            auto outdir = download_dir.empty() ? "." : download_dir;
-            auto outname = file_name.empty() ? std::filesystem::path(info.file_name) : file_name.filename();
-            auto path = rewrite ? outdir / outname : get_unique_file_path(outdir, outname);
-            std::ofstream of(path, std::ios::binary | std::ios::trunc);
+            key = Journal::key(url, download_dir / file_name);
 
-            if (of.is_open())
+            if (auto entry = journal->find(key))
             {
-                connection.download(of);
+                /* only a done record proves the file is complete, an empty placeholder exists from the start */
+                if (entry->state == Journal::Entry::State::done && std::filesystem::exists(entry->final))
+                    return entry->final;
+
+                /* the name claimed by the previous run is reused */
+                path = entry->final;
+
+                /* continue the part left by an interrupted run, a lost part is downloaded again */
+                if (!entry->temp.empty() && std::filesystem::exists(entry->temp))
+                {
+                    resume_offset = std::min<size_t>(entry->committed, std::filesystem::file_size(entry->temp));
+                    resume_validator = entry->validator;
+                }
             }
-            else
+        }
+
+        auto get_path = [&]()
+        {
+            if (path.empty())
             {
-                std::string msg = "Unable to open file '";
-                msg += path.string();
-                msg += "'.";
-                throw std::runtime_error(msg);
+                auto outdir = download_dir.empty() ? "." : download_dir;
+                auto outname = file_name.empty() ? std::filesystem::path(info.file_name) : file_name.filename();
+
+                /* directory URL */
+                if (outname.empty())
+                    throw std::invalid_argument("Invalid URL: file name is missing.");
+
+                path = rewrite ? outdir / outname : get_unique_file_path(outdir, outname);
             }
 
-            return;
-        }
+            return path;
+        };
 
-        std::string msg = "Unsuccessful request. Status code: ";
-        msg += std::to_string(status.status_code);
-        msg += ' ';
-        msg += status.status_text;
-        msg += '.';
-
-        if (status.status_code == 301 ||
-            status.status_code == 302 ||
-            status.status_code == 303 ||
-            status.status_code == 305 ||
-            status.status_code == 307 ||
-            status.status_code == 308 )
-         {
-             auto headers = connection.retrieve_headers();
-             auto it = headers.find("location");
-
-             if (it != headers.end())
-             {
-                 msg += " New location: ";
-                 msg += it->second;
-             }
-         }
-
-        throw std::runtime_error(msg);
-    }
+        isink_ptr_t sink;
+        header_list_t headers;
 
-    Downloader::Request_Info Downloader::create_request_info(const std::string& url)
-    {
-        if (url.empty())
+        Status_Line status;
+
+        auto get_sink = [&](bool restart) -> ISink&
         {
-            throw std::invalid_argument("URL is not specified.");
-        }
+            if (!sink || restart)
+            {
+                sink.reset();
 
-        std::regex valid_http_url_regex(VALID_HTTP_URL_REGEX);
-        std::smatch match;
+                if (!journal)
+                {
+                    sink = create_file_sink(get_path(), output_mode);
+                    return *sink;
+                }
 
-        if (!std::regex_match(url, match, valid_http_url_regex))
-        {
-            throw std::invalid_argument("Invalid URL.");
-        }
+                /* content goes to a temporary name and is renamed into place when complete */
+                auto temp = Journal::temp_path(get_path());
+                isink_ptr_t file;
+                size_t from = 0;
 
-        Request_Info info;
-        info.protocol = match[1].str();
-        info.host = match[2].str();
+                if (resume_offset && !restart)
+                {
+                    from = resume_offset;
+                    std::filesystem::resize_file(temp, from);
+                    file = std::make_unique<File_Sink>(temp, true);
+                }
+                else
+                {
+                    file = create_file_sink(temp, output_mode);
+                    journal->started(key, temp, path);
+                }
 
-        auto port_str = match[3].str();
+                sink = std::make_unique<Journal_Sink>(std::move(file), *journal, key, temp, from, range_validator(headers));
+            }
 
-        if (port_str.empty())
+            return *sink;
+        };
+
+        try
         {
-            info.port = 80;
+            status = fetch(info, conditions, get_sink, headers, resume_offset, resume_validator);
+
+            /* the cached copy was replaced meanwhile, the validators sent no longer describe it */
+            if (status.status_code == 304 && !cache->restore(*cached, get_path()))
+                status = fetch(info, std::string(), get_sink, headers);
         }
-        else
+        catch (const std::exception& e)
         {
-            auto port_val = std::strtoul(port_str.c_str(), nullptr, 10);
-
-            if (0 == port_val ||
-                ULONG_MAX == port_val ||
-                USHRT_MAX < port_val)
-            {
-                std::string msg = "Invalid port value: ";
-                msg += port_str;
-                throw std::invalid_argument(msg);
-            }
+            if (journal)
+                journal->failed(key, e.what());
 
-            info.port = static_cast<std::uint16_t>(port_val);
+            throw;
         }
 
-        info.url = match[4].str();
-        info.file_name = match[5].str();
-
-        return info;
-    }
-
-    std::string Downloader::create_get_request(const Downloader::Request_Info& info)
-    {
-        std::string request = "GET /";
-        request += info.url;
-        request += " HTTP/1.1\r\nHost: ";
-        request += info.host;
-        request += "\r\nUser-Agent: downloader\r\nAccept: */*\r\nConnection: keep-alive\r\n\r\n";
-        return request;
-    }
+        sink.reset();
 
-    std::filesystem::path Downloader::get_unique_file_path(const std::filesystem::path& dir,
-                                                           const std::filesystem::path& file_name)
-    {
-        if (!std::filesystem::exists(dir))
+        /* unchanged, the file was taken from cache */
+        if (status.status_code == 304)
         {
-            std::filesystem::create_directories(dir);
-        }
+            if (journal)
+                journal->done(key, path);
 
-        std::filesystem::path file_path = dir / file_name.filename();
-        auto stem = file_path.stem().string();
-        auto extension = file_path.extension().string();
+            return path;
+        }
 
-        unsigned i = 1;
-        while (i < MAX_FILE_NAME_TRYOUTS && std::filesystem::exists(file_path))
+        if (journal)
         {
-            auto distinct_file_name = stem;
-            distinct_file_name += " (";
-            distinct_file_name += std::to_string(i);
-            distinct_file_name += ")";
-            distinct_file_name += extension;
-            file_path.replace_filename(distinct_file_name);
-            ++i;
+            std::filesystem::rename(Journal::temp_path(path), path);
+            journal->done(key, path);
         }
 
-        if (MAX_FILE_NAME_TRYOUTS == i)
+        if (cache)
         {
-            std::string msg = "Unable to obtain unique name for file '";
-            msg += file_name;
-            msg += "'. Try to change download directory.";
-            throw std::runtime_error(msg);
+            auto etag = headers.find("etag");
+            auto last_modified = headers.find("last-modified");
+
+            cache->store(url,
+                         etag != headers.end() ? etag->second : std::string(),
+                         last_modified != headers.end() ? last_modified->second : std::string(),
+                         path);
         }
 
-        return file_path;
+        return path;
     }
 
-    Downloader::Connection::Connection(ipgrogress_ptr_t& pr) noexcept :
-        progress(pr)
+    void Downloader::dowload(const std::string& url, ISink& sink)
     {
+        auto info = create_request_info(url);
+        header_list_t headers;
 
+        fetch(info, std::string(), [&](bool restart) -> ISink&
+        {
+            /* sink is unable to discard what it has already received */
+            if (restart)
+            {
+                throw std::runtime_error("Unable to resume download: range request is ignored by server.");
+            }
+
+            return sink;
+        }, headers);
     }
 
-    Downloader::Connection::~Connection()
+    void Downloader::set_output_mode(Output_Mode mode) noexcept
     {
-        close();
+        output_mode = mode;
     }
 
-    void Downloader::Connection::connect(const std::string& host, uint16_t port)
+    void Downloader::set_cache(std::shared_ptr<Http_Cache> c) noexcept
     {
-        sockaddr_in sin;
-        sin.sin_family = AF_INET;
-        sin.sin_port = htons(port);
-        sin.sin_addr = resolve_name(host);
-
-        sock = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-        if (sock < 0)
-        {
-            std::string msg = "Unable to create socket: ";
-            msg += ::strerror(errno);
-            throw std::runtime_error(msg);
-        }
-
-        timeval tv;
-        tv.tv_sec = DOWNLOAD_RCV_TIMEOUT_S;
-        tv.tv_usec = 0;
-
-        if (::setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv)) == -1)
-        {
-            close();
-            std::string msg = "Could not set socket option SO_RCVTIMEO: ";
-            msg += ::strerror(errno);
-            throw std::runtime_error(msg);
-        }
-
-        if (::connect(sock, (const sockaddr*) &sin, sizeof(sin)) < 0)
-        {
-            close();
-            std::string msg = "Unable to connect to ";
-            msg += host;
-            msg += " (";
-            msg += ::inet_ntoa (sin.sin_addr);
-            msg += ") : ";
-            msg += ::strerror(errno);
-            throw std::runtime_error(msg);
-        }
+        cache = std::move(c);
     }
 
-    void Downloader::Connection::send_request(const std::string& request) const
+    void Downloader::set_retry_policy(const Retry_Policy& policy) noexcept
     {
-        auto bytes_sent = ::send(sock, request.c_str(), request.length(), MSG_NOSIGNAL);
-
-        if ((unsigned int) bytes_sent < request.length())
-        {
-            std::string msg = "Unable to send request: ";
-            msg += strerror(errno);
-            throw std::runtime_error(msg);
-        }
+        retry_policy = policy;
     }
 
-    Downloader::Connection::Status_Line Downloader::Connection::retrieve_http_status_line()
+    void Downloader::set_hedge_policy(const Hedge_Policy& policy) noexcept
     {
-        char buff[RCV_SMALL_BUFF_SIZE];
-        bool cr_found = false;
-        bool lf_found = false;
-        std::string status_line;
-        ssize_t bytes_read;
-        ssize_t i = 0;
-
-        while (!(cr_found && lf_found))
-        {
-            check_if_canceled();
+        hedge_policy = policy;
+    }
 
-            bytes_read = ::recv(sock, buff, sizeof(buff), 0);
+    void Downloader::set_cancel_token(const Cancel_Token& token) noexcept
+    {
+        cancel_token = token;
+    }
 
-            if (bytes_read < 0)
-            {
-                if (errno == EINTR)
-                    continue;
+    void Downloader::set_journal(std::shared_ptr<Journal> j) noexcept
+    {
+        journal = std::move(j);
+    }
 
-                std::string msg = "Unable to check status code: ";
-                msg += strerror(errno);
-                throw std::runtime_error(msg);
-            }
+    Status_Line Downloader::fetch(const Request_Info& info,
+                                  const std::string& conditions,
+                                  const sink_provider_t& get_sink,
+                                  header_list_t& headers,
+                                  size_t offset,
+                                  std::string validator)
+    {
+        std::string name = info.host;
+        name += '/';
+        name += info.url;
+        Transfer_Stats stats(name);
 
-            if (bytes_read == 0)
+        for (unsigned attempt = 1; ; ++attempt)
+        {
+            Connection connection(progress);
+            connection.set_receive_timeout(retry_policy.stall_timeout);
+            connection.set_speed_limit(retry_policy.low_speed_limit, retry_policy.low_speed_time);
+            connection.set_cancel_token(cancel_token);
+            connection.set_transfer_stats(&stats);
+            stats.set_phase(Transfer_Phase::connecting);
+
+            try
             {
-                throw std::runtime_error("Invalid server response: Unable to retrieve status line");
-            }
+                Status_Line status;
 
-            i = 0;
-
-            if (cr_found)
-            {
-                if (buff[i] == '\n')
+                if (offset)
                 {
-                    lf_found = true;
-                    ++i;
+                    /* resume from the last byte written */
+                    auto range = range_headers(offset, validator);
+                    status = start_request(connection, info, create_get_request(info, range), { 200, 206 });
                 }
-                else
+                else if (!conditions.empty())
                 {
-                    throw std::domain_error("Invalid server response");
+                    status = start_request(connection, info, create_get_request(info, conditions), { 200, 304 });
                 }
-            }
-            else
-            {
-                while (i < bytes_read)
+                else
                 {
-                    if (buff[i] == '\r')
-                    {
-                        cr_found = true;
-
-                        if (++i < RCV_SMALL_BUFF_SIZE)
-                        {
-                            if (buff[i] == '\n')
-                            {
-                                lf_found = true;
-                                ++i;
-                                break;
-                            }
-                            else
-                            {
-                                throw std::domain_error("Invalid server response");
-                            }
-                        }
-                    }
-
-                    ++i;
+                    status = start_request(connection, info, create_get_request(info));
                 }
-            }
-
-            size_t end = i;
 
-            if (cr_found)
-                --end;
-
-            if (lf_found)
-                --end;
-
-            status_line.append(buff, end);
-        }
-
-        buffer.append(&buff[i], bytes_read - i);
-
-        size_t len = status_line.length();
-        size_t s = 0;
-        size_t e;
-
-        Status_Line status;
-
-        while (s < len && std::isspace(status_line[s])) ++s;
-
-        e = s;
-        while (e < len && !std::isspace(status_line[e])) ++e;
-
-        status.protocol_version.append(status_line, s, e - s);
-
-        s = e;
-        while (s < len && std::isspace(status_line[s])) ++s;
-
-        e = s;
-        while (e < len && !std::isspace(status_line[e])) ++e;
-
-        std::string code;
-        code.append(status_line, s, e - s);
-        status.status_code = std::strtoul(code.c_str(), nullptr, 10);
-
-        s = e;
-        while (s < len && std::isspace(status_line[s])) ++s;
+                if (status.status_code == 304)
+                {
+                    stats.finish(true);
+                    return status;
+                }
 
-        status.status_text.append(status_line, s, len - s);
+                headers = connection.retrieve_headers();
+                stats.set_phase(Transfer_Phase::receiving);
 
-        return status;
-    }
+                bool restart = false;
 
-    Downloader::Connection::header_list_t Downloader::Connection::retrieve_headers()
-    {
-        std::string headers;
+                if (status.status_code == 206)
+                {
+                    if (content_range_start(headers) != offset)
+                    {
+                        throw std::runtime_error("Invalid server response: Unexpected Content-Range.");
+                    }
+                }
+                else
+                {
+                    restart = offset != 0;
+                    offset = 0;
+                    validator = range_validator(headers);
+                }
 
-        const char* marker = "\r\n\r\n";
-        const auto marker_len = std::strlen(marker);
+                auto length = headers.find("content-length");
+                size_t end = 0;
 
-        std::string::size_type start_pos = 0;
-        std::string::size_type marker_pos = std::string::npos;
+                if (length != headers.end())
+                {
+                    end = offset + std::strtoull(length->second.c_str(), nullptr, 10);
+                    stats.set_total(end);
+                }
 
-        while (true)
-        {
-            check_if_canceled();
+                auto position = transfer(connection, info, get_sink(restart), headers, offset, validator);
 
-            marker_pos = buffer.find(marker, start_pos);
+                /* the hedge delivered a part of the range, the rest is requested again */
+                if (position < end)
+                {
+                    offset = position;
+                    --attempt;
+                    continue;
+                }
 
-            if (marker_pos != std::string::npos)
-            {
-                headers = buffer.substr(0, marker_pos + marker_len);
-                auto body = buffer.substr(marker_pos + marker_len);
-                buffer.swap(body);
-                break;
+                connection.recycle(status, headers);
+                stats.finish(true);
+                return status;
             }
-
-            start_pos = buffer.length() > marker_len ? buffer.length() - marker_len + 1 : 0;
-
-            char buff[RCV_LARGE_BUFF_SIZE];
-
-            auto bytes_read = ::recv(sock, buff, sizeof(buff), 0);
-
-            if (bytes_read < 0)
+            catch (const Transfer_Error&)
             {
-                if (errno == EINTR)
+                /* idle connection closed by server meanwhile, does not count as attempt */
+                if (connection.is_reused() && connection.received() == 0)
+                {
+                    --attempt;
                     continue;
+                }
 
-                std::string msg = "Unable to retrieve http headers: ";
-                msg += strerror(errno);
-                throw std::runtime_error(msg);
-            }
+                offset += connection.received();
 
-            if (bytes_read == 0)
+                if (attempt >= retry_policy.max_attempts)
+                    throw;
+            }
+            catch (const Status_Error& e)
             {
-                throw std::runtime_error("Invalid server response: Unable to retrieve headers");
+                if (attempt >= retry_policy.max_attempts ||
+                    !Retry_Policy::is_retryable_status(e.status_code))
+                    throw;
             }
 
-            buffer.append(buff, bytes_read);
+            stats.retry();
+            stats.set_phase(Transfer_Phase::waiting);
+            wait_before_retry(attempt);
         }
-
-        return parse_headers(headers);
     }
 
-    void Downloader::Connection::download(std::ofstream& of)
+    size_t Downloader::transfer(Connection& connection,
+                                const Request_Info& info,
+                                ISink& sink,
+                                const header_list_t& headers,
+                                size_t offset,
+                                const std::string& validator)
     {
-        auto headers = retrieve_headers();
+        auto started = std::chrono::steady_clock::now();
+        std::unique_ptr<Hedge> hedge;
 
-        auto it = headers.find("transfer-encoding");
+        auto length = headers.find("content-length");
 
-        if (it == headers.end())
+        /* only a known remaining range can be requested twice */
+        if (hedge_policy.enabled &&
+            length != headers.end() &&
+            headers.find("transfer-encoding") == headers.end())
         {
-            it = headers.find("content-length");
-
-            if (it == headers.end())
-            {
-                throw std::runtime_error("Invalid headers. Neither Transfer-Encoding nor Content-Length are present.");
-            }
-
-            auto length = std::strtoll(it->second.c_str(), nullptr, 10);
-
-            if (progress)
-            {
-                progress->start();
-                progress->set_total(length);
-            }
-
-            download_content(of, length);
+            auto end = offset + std::strtoull(length->second.c_str(), nullptr, 10);
+
+            hedge = std::make_unique<Hedge>(hedge_policy,
+                                            info.host,
+                                            info.port,
+                                            [info, validator](size_t from)
+                                            {
+                                                return create_get_request(info, range_headers(from, validator));
+                                            },
+                                            connection,
+                                            offset,
+                                            end,
+                                            retry_policy.stall_timeout,
+                                            cancel_token);
+        }
 
-            if (progress)
-            {
-                progress->stop();
-            }
+        try
+        {
+            connection.download(sink, headers);
         }
-        else
+        catch (...)
         {
-            auto encoding = it->second;
-            str_tolower(encoding);
-
-            if (encoding.find("chunked") == std::string::npos)
-            {
-                std::string msg = "Unsupported Transfer-Encoding: ";
-                msg += encoding;
-                throw std::runtime_error(msg);
-            }
+            if (!hedge || !hedge->won())
+                throw;
 
-            if (progress)
-            {
-                progress->start();
-                progress->set_total(0);
-            }
-
-            download_chunks(of);
-
-            if (progress)
-            {
-                progress->stop();
-            }
+            /* primary was aborted by the hedge, take the rest from it */
+            return hedge->complete(sink, offset + connection.received(), progress);
         }
+
+        hedge.reset();
+        Host_Stats::shared().record(info.host, connection.received(), std::chrono::steady_clock::now() - started);
+        return offset + connection.received();
     }
 
-    in_addr Downloader::Connection::resolve_name(const std::string& hostname)
+    void Downloader::wait_before_retry(unsigned attempt)
     {
-        addrinfo hint {0, AF_INET, SOCK_STREAM, 0, 0, nullptr, nullptr, nullptr};
-        addrinfo* info = nullptr;
-
-        auto result = ::getaddrinfo (hostname.c_str (), nullptr, &hint, &info);
+        auto deadline = std::chrono::steady_clock::now() + retry_policy.delay(attempt);
 
-        if (result)
+        while (true)
         {
-            std::string msg = "Can't resolve host name.";
-            throw std::runtime_error(msg);
-        }
+            if (cancel_token.is_canceled() || (progress && progress->is_canceled()))
+                throw std::runtime_error("Canceled.");
 
-        in_addr addr = reinterpret_cast<sockaddr_in*>(info->ai_addr)->sin_addr;
+            auto now = std::chrono::steady_clock::now();
 
-        ::freeaddrinfo(info);
+            if (now >= deadline)
+                break;
 
-        return addr;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, std::chrono::milliseconds(RETRY_SLEEP_SLICE_MS)));
+        }
     }
 
-    Downloader::Connection::header_list_t Downloader::Connection::parse_headers(const std::string& headers)
+    std::string Downloader::range_validator(const header_list_t& headers)
     {
-        header_list_t list;
-
-        size_t len = headers.length();
-        size_t i = 0;
-
-        bool key_part = true;
-        bool end_line = false;
-        bool space = false;
-        bool inside = false;
-        std::string key;
-        std::string val;
-
-        while (i < len)
-        {
-            auto ch = headers[i];
+        /* If-Range requires strong entity tag */
+        auto it = headers.find("etag");
 
-            switch (ch)
-            {
-                case ':':
-                {
-                    if (key_part)
-                    {
-                        key_part = false;
+        if (it != headers.end() && it->second.compare(0, 2, "W/") != 0)
+            return it->second;
 
-                        /* skip spaces */
-                        inside = false;
-                        space = false;
-                    }
-                    else
-                    {
-                        val.push_back(ch);
-                    }
-
-                    break;
-                }
+        it = headers.find("last-modified");
 
-                case '\r':
-                {
-                    end_line = true;
-                    break;
-                }
+        if (it != headers.end())
+            return it->second;
 
-                case '\n':
-                {
-                    if (!end_line)
-                    {
-                        std::string msg = "Invalid server response: Unable to parse headers.";
-                        throw std::runtime_error(msg);
-                    }
-
-                    end_line = false;
-                    key_part = true;
-
-                    if (!key.empty()) {
-                        str_tolower(key);
-                        list.insert(std::pair{ std::move(key), std::move(val) });
-                    }
-
-                    /* skip spaces */
-                    inside = false;
-                    space = false;
-                    break;
-                }
-
-                case '\t':
-                case ' ':
-                {
-                    /* normalize spacing */
-                    if (inside)
-                        space = true;
-
-                    break;
-                }
-
-                default:
-                {
-                    inside = true;
-
-                    if (key_part)
-                    {
-                        if (space)
-                        {
-                            key.push_back(' ');
-                            space = false;
-                        }
-
-                        key.push_back(ch);
-                    }
-                    else
-                    {
-                        if (space)
-                        {
-                            val.push_back(' ');
-                            space = false;
-                        }
-
-                        val.push_back(ch);
-                    }
-                }
-            }
-
-            ++i;
-        }
-
-        return list;
+        return std::string();
     }
 
-    void Downloader::Connection::write(std::ofstream& of, const char* buff, size_t len) noexcept
+    std::string Downloader::range_headers(size_t from, const std::string& validator)
     {
-        of.write(buff, len);
+        std::string range = "Range: bytes=";
+        range += std::to_string(from);
+        range += "-\r\n";
 
-        if (progress)
+        if (!validator.empty())
         {
-            progress->add_progress(len);
+            range += "If-Range: ";
+            range += validator;
+            range += "\r\n";
         }
+
+        return range;
     }
 
-    void Downloader::Connection::close() noexcept
+    Status_Line Downloader::start_request(Connection& connection,
+                                          const Request_Info& info,
+                                          const std::string& request,
+                                          std::initializer_list<unsigned> accepted)
     {
-        if (sock > 0)
+        if (info.protocol != "http" && info.protocol != "https")
         {
-            ::close(sock);
-            sock = -1;
+            std::string msg = "Unsupported protocol: ";
+            msg += info.protocol;
+            throw std::runtime_error(msg);
         }
 
-        if (progress)
-        {
-            progress->stop();
-        }
-    }
-
-    void Downloader::Connection::check_if_canceled()
-    {
-        if (progress && progress->is_canceled())
-            throw std::runtime_error("Canceled.");
-    }
+        connection.set_secure(info.protocol == "https");
+        connection.connect(info.host, info.port);
+        connection.send_request(request);
+        auto status = connection.retrieve_http_status_line();
 
-    void Downloader::Connection::download_content(std::ofstream& of, ssize_t len)
-    {
-        if (len < static_cast<ssize_t>(buffer.length()))
+        if (std::find(accepted.begin(), accepted.end(), status.status_code) != accepted.end())
         {
-            throw std::runtime_error("Unable to get content");
+            return status;
         }
 
-        write(of, buffer.data(), buffer.length());
-        len -= buffer.length();
-        buffer.clear();
+        header_list_t headers;
 
-        while (len)
+        if (is_redirect(status.status_code))
         {
-            check_if_canceled();
-
-            char buff[RCV_CHUNK_BUFF_SIZE];
-
-            auto bytes_read = ::recv(sock, buff, sizeof(buff), 0);
-
-            if (bytes_read < 0)
-            {
-                if (errno == EINTR)
-                    continue;
-
-                std::string msg = "Unable to download content: ";
-                msg += strerror(errno);
-                throw std::runtime_error(msg);
-            }
-
-            if (bytes_read == 0)
-            {
-                throw std::runtime_error("Invalid server response: Unable to download content.");
-            }
-
-            write(of, buff, bytes_read);
-            len = len > bytes_read ? len - bytes_read : 0;
+            headers = connection.retrieve_headers();
         }
+
+        auto msg = unsuccessful_status_message(status, headers);
+        throw Status_Error(status.status_code, msg);
     }
 
-    void Downloader::Connection::download_chunks(std::ofstream& of)
+    Downloader::Request_Info Downloader::create_request_info(const std::string& url)
     {
-        while (size_t len = get_chunk_length())
+        if (url.empty())
         {
-            download_chunk(of, len);
+            throw std::invalid_argument("URL is not specified.");
         }
-    }
-
-    ssize_t Downloader::Connection::get_chunk_length()
-    {
-        ssize_t length = 0;
-
-        const char* marker = "\r\n";
-        const auto marker_len = std::strlen(marker);
 
-        std::string::size_type find_start_pos = 0;
-        std::string::size_type number_start_pos = 0;
-        std::string::size_type marker_pos = std::string::npos;
+        static const std::regex valid_http_url_regex(VALID_HTTP_URL_REGEX);
+        std::smatch match;
 
-        while (true)
+        if (!std::regex_match(url, match, valid_http_url_regex))
         {
-            check_if_canceled();
-
-            marker_pos = buffer.find(marker, find_start_pos);
-
-            if (marker_pos != std::string::npos)
-            {
-                /* skip leading crlf */
-                if (marker_pos == 0)
-                {
-                    number_start_pos = marker_len;
-                    find_start_pos = marker_len;
-                    continue;
-                }
-                else
-                {
-                    length = std::strtoll(buffer.substr(number_start_pos, marker_pos).c_str(), nullptr, 16);
-                    auto body = buffer.substr(marker_pos + marker_len);
-                    buffer.swap(body);
-                    break;
-                }
-            }
-
-            find_start_pos = buffer.length() > marker_len ? buffer.length() - marker_len + 1 : 0;
-
-            char buff[RCV_CHUNK_BUFF_SIZE];
+            throw std::invalid_argument("Invalid URL.");
+        }
 
-            auto bytes_read = ::recv(sock, buff, sizeof(buff), 0);
+        Request_Info info;
+        info.protocol = match[1].str();
+        str_tolower(info.protocol);
+        info.host = match[2].str();
 
-            if (bytes_read < 0)
-            {
-                if (errno == EINTR)
-                    continue;
+        auto port_str = match[3].str();
 
-                std::string msg = "Unable to obtain chunk length: ";
-                msg += strerror(errno);
-                throw std::runtime_error(msg);
-            }
+        if (port_str.empty())
+        {
+            info.port = info.protocol == "https" ? 443 : 80;
+        }
+        else
+        {
+            auto port_val = std::strtoul(port_str.c_str(), nullptr, 10);
 
-            if (bytes_read == 0)
+            if (0 == port_val ||
+                ULONG_MAX == port_val ||
+                USHRT_MAX < port_val)
             {
-                throw std::runtime_error("Invalid server response: Unable to obtain chunk length.");
+                std::string msg = "Invalid port value: ";
+                msg += port_str;
+                throw std::invalid_argument(msg);
             }
 
-            buffer.append(buff, bytes_read);
+            info.port = static_cast<std::uint16_t>(port_val);
         }
 
-        return length;
+        info.url = match[4].str();
+        info.file_name = match[5].str();
+
+        return info;
     }
 
-    void Downloader::Connection::download_chunk(std::ofstream& of, ssize_t len)
+    std::string Downloader::create_get_request(const Downloader::Request_Info& info,
+                                               const std::string& extra_headers)
     {
-        if (len < static_cast<ssize_t>(buffer.length()))
-        {
-            write(of, buffer.data(), len);
-            auto tail = buffer.substr(len);
-            buffer.swap(tail);
-            return;
-        }
-
-        write(of, buffer.data(), buffer.length());
-        len -= buffer.length();
-        buffer.clear();
-
-        while (len)
-        {
-            check_if_canceled();
-
-            char buff[RCV_CHUNK_BUFF_SIZE];
-
-            auto bytes_read = ::recv(sock, buff, sizeof(buff), 0);
-
-            if (bytes_read < 0)
-            {
-                if (errno == EINTR)
-                    continue;
-
-                std::string msg = "Unable to download chunk: ";
-                msg += strerror(errno);
-                throw std::runtime_error(msg);
-            }
+        return create_request("GET", info, extra_headers);
+    }
 
-            if (bytes_read == 0)
-            {
-                throw std::runtime_error("Invalid server response: Unable to download chunk.");
-            }
+    std::string Downloader::create_head_request(const Downloader::Request_Info& info)
+    {
+        return create_request("HEAD", info, std::string());
+    }
 
-            if (len < bytes_read)
-            {
-                write(of, buff, len);
-                buffer.append(&buff[len], bytes_read - len);
-                break;
-            }
+    std::string Downloader::create_request(const char* method,
+                                           const Downloader::Request_Info& info,
+                                           const std::string& extra_headers)
+    {
+        std::string request = method;
+        request += " /";
+        request += info.url;
+        request += " HTTP/1.1\r\nHost: ";
+        request += info.host;
+        request += "\r\nUser-Agent: downloader\r\nAccept: */*\r\nConnection: keep-alive\r\n";
+        request += extra_headers;
+        request += "\r\n";
+        return request;
+    }
 
-            write(of, buff, bytes_read);
-            len = len - bytes_read;
-        }
+    std::filesystem::path Downloader::get_unique_file_path(const std::filesystem::path& dir,
+                                                           const std::filesystem::path& file_name)
+    {
+        return Name_Allocator::shared().claim(dir, file_name);
     }
 }
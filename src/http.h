@@ -3,11 +3,22 @@
 
 #include <netinet/in.h>
 
+#include <chrono>
 #include <filesystem>
+#include <functional>
+#include <initializer_list>
 #include <vector>
-#include <unordered_map>
 
+#include "cache.h"
+#include "cancel.h"
+#include "connection.h"
+#include "hedge.h"
 #include "iprogress.h"
+#include "isink.h"
+#include "journal.h"
+#include "protocol.h"
+#include "retry.h"
+#include "sinks.h"
 
 /*
  * RFC 2616 - "Hypertext Transfer Protocol -- HTTP/1.1"
@@ -24,12 +35,21 @@ namespace http
     public:
         Downloader(ipgrogress_ptr_t pr) noexcept;
 
-        void dowload(const std::string& url,
-                     const std::filesystem::path& download_dir,
-                     const std::filesystem::path& file_name,
-                     bool rewrite);
+        std::filesystem::path dowload(const std::string& url,
+                                      const std::filesystem::path& download_dir,
+                                      const std::filesystem::path& file_name,
+                                      bool rewrite);
 
-    private:
+        void dowload(const std::string& url, ISink& sink);
+
+        void set_output_mode(Output_Mode mode) noexcept;
+        void set_cache(std::shared_ptr<Http_Cache> c) noexcept;
+        void set_retry_policy(const Retry_Policy& policy) noexcept;
+        void set_hedge_policy(const Hedge_Policy& policy) noexcept;
+        void set_cancel_token(const Cancel_Token& token) noexcept;
+        void set_journal(std::shared_ptr<Journal> j) noexcept;
+
+    public:
         struct Request_Info
         {
             std::string protocol;
@@ -40,55 +60,47 @@ namespace http
         };
 
         static Request_Info create_request_info(const std::string& url);
-        static std::string create_get_request(const Request_Info& info);
-
-        class Connection
-        {
-        public:
-            struct Status_Line
-            {
-                std::string protocol_version;
-                unsigned status_code;
-                std::string status_text;
-            };
-
-            using header_list_t = std::unordered_multimap<std::string, std::string>;
-
-        public:
-            Connection(ipgrogress_ptr_t& pr) noexcept;
-            ~Connection();
-
-            void connect(const std::string& host, std::uint16_t port);
-            void send_request(const std::string& request) const;
-            Status_Line retrieve_http_status_line();
-            header_list_t retrieve_headers();
-            void download(std::ofstream& of);
-
-        private:
-            static in_addr resolve_name(const std::string& hostname);
-            static header_list_t parse_headers(const std::string& headers);
-
-            void write(std::ofstream& of, const char* buff, size_t len) noexcept;
-            void close() noexcept;
-            void check_if_canceled();
-
-            void download_content(std::ofstream& of, ssize_t len);
-            void download_chunks(std::ofstream& of);
-            ssize_t get_chunk_length();
-            void download_chunk(std::ofstream& of, ssize_t len);
-
-        private:
-            int sock = -1;
-            std::string buffer;
-            ipgrogress_ptr_t& progress;
-        };
+        static std::string create_get_request(const Request_Info& info,
+                                              const std::string& extra_headers = std::string());
+        static std::string create_head_request(const Request_Info& info);
 
     private:
+        using sink_provider_t = std::function<ISink&(bool restart)>;
+
+        Status_Line fetch(const Request_Info& info,
+                          const std::string& conditions,
+                          const sink_provider_t& get_sink,
+                          header_list_t& headers,
+                          size_t offset = 0,
+                          std::string validator = std::string());
+        size_t transfer(Connection& connection,
+                        const Request_Info& info,
+                        ISink& sink,
+                        const header_list_t& headers,
+                        size_t offset,
+                        const std::string& validator);
+        void wait_before_retry(unsigned attempt);
+        static std::string range_validator(const header_list_t& headers);
+        static std::string range_headers(size_t from, const std::string& validator);
+        static std::string create_request(const char* method,
+                                          const Request_Info& info,
+                                          const std::string& extra_headers);
+
+        Status_Line start_request(Connection& connection,
+                                  const Request_Info& info,
+                                  const std::string& request,
+                                  std::initializer_list<unsigned> accepted = { 200 });
         std::filesystem::path get_unique_file_path(const std::filesystem::path& dir,
                                                    const std::filesystem::path& file_name);
 
     private:
         ipgrogress_ptr_t progress;
+        Output_Mode output_mode = Output_Mode::stream;
+        std::shared_ptr<Http_Cache> cache;
+        Retry_Policy retry_policy;
+        Hedge_Policy hedge_policy;
+        Cancel_Token cancel_token;
+        std::shared_ptr<Journal> journal;
     };
 }
 
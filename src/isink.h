@@ -0,0 +1,29 @@
+#ifndef ISINK_H
+#define ISINK_H
+
+#include <cstring>
+#include <memory>
+
+namespace http
+{
+    struct ISink
+    {
+        virtual ~ISink() = default;
+
+        virtual void reserve(size_t) = 0;
+        virtual void write(const char*, size_t) = 0;
+        virtual void finish() = 0;
+    };
+
+    /* sink which lets the connection receive straight into its memory */
+    struct IDirect_Sink : ISink
+    {
+        /* returns memory for at most len bytes (len is updated) or nullptr */
+        virtual char* acquire(size_t& len) = 0;
+        virtual void commit(size_t len) = 0;
+    };
+
+    using isink_ptr_t = std::unique_ptr<ISink>;
+}
+
+#endif // ISINK_H
@@ -0,0 +1,482 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "journal.h"
+
+#define JOURNAL_SYNC_INTERVAL_MS    200
+#define JOURNAL_CHECKPOINT_BYTES    (16 * 1024 * 1024)
+#define JOURNAL_TEMP_SUFFIX         ".part"
+
+namespace http
+{
+    namespace
+    {
+        std::vector<std::string> split(const std::string& record)
+        {
+            std::vector<std::string> fields;
+            std::istringstream in(record);
+            std::string field;
+
+            while (std::getline(in, field, '\t'))
+                fields.push_back(std::move(field));
+
+            return fields;
+        }
+
+        /* fields must not break the line format */
+        std::string sanitize(std::string value)
+        {
+            std::replace_if(value.begin(), value.end(), [](char ch) { return ch == '\t' || ch == '\n' || ch == '\r'; }, ' ');
+            return value;
+        }
+
+        void sync_directory(const std::filesystem::path& dir)
+        {
+            int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+            if (fd >= 0)
+            {
+                ::fsync(fd);
+                ::close(fd);
+            }
+        }
+    }
+
+    Journal::Journal(const std::filesystem::path& p) :
+        path(p)
+    {
+        replay();
+        compact();
+
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+            fail("open");
+
+        flusher = std::thread(&Journal::run, this);
+    }
+
+    Journal::~Journal()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        cv.notify_one();
+        flusher.join();
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    std::optional<Journal::Entry> Journal::find(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = entries.find(key);
+
+        if (it == entries.end())
+            return std::nullopt;
+
+        return it->second;
+    }
+
+    void Journal::started(const std::string& key, const std::filesystem::path& temp, const std::filesystem::path& final)
+    {
+        std::string record = "start\t";
+        record += sanitize(key);
+        record += '\t';
+        record += sanitize(temp.string());
+        record += '\t';
+        record += sanitize(final.string());
+        append(std::move(record), false);
+    }
+
+    void Journal::committed(const std::string& key, size_t offset, const std::string& validator)
+    {
+        std::string record = "commit\t";
+        record += sanitize(key);
+        record += '\t';
+        record += std::to_string(offset);
+        record += '\t';
+        record += sanitize(validator);
+        append(std::move(record), false);
+    }
+
+    void Journal::done(const std::string& key, const std::filesystem::path& final)
+    {
+        /* the rename must survive a crash before the record does */
+        sync_directory(final.parent_path());
+
+        std::string record = "done\t";
+        record += sanitize(key);
+        record += '\t';
+        record += sanitize(final.string());
+        append(std::move(record), true);
+    }
+
+    void Journal::failed(const std::string& key, const std::string& error)
+    {
+        std::string record = "fail\t";
+        record += sanitize(key);
+        record += '\t';
+        record += sanitize(error);
+        append(std::move(record), true);
+    }
+
+    void Journal::flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        auto target = appended;
+        urgent = true;
+        cv.notify_one();
+
+        synced_cv.wait(lock, [&]() { return synced >= target || error; });
+
+        if (error)
+        {
+            errno = error;
+            fail("write");
+        }
+    }
+
+    std::string Journal::key(const std::string& url, const std::filesystem::path& destination)
+    {
+        /* URL has no spaces */
+        std::string key = url;
+        key += ' ';
+        key += destination.string();
+        return key;
+    }
+
+    std::filesystem::path Journal::temp_path(const std::filesystem::path& final)
+    {
+        std::string name = ".";
+        name += final.filename().string();
+        name += JOURNAL_TEMP_SUFFIX;
+        return final.parent_path() / name;
+    }
+
+    void Journal::replay()
+    {
+        std::ifstream in(path);
+        std::string line;
+
+        while (std::getline(in, line))
+        {
+            /* last line is torn */
+            if (in.eof())
+                break;
+
+            auto pos = line.rfind('\t');
+
+            if (pos == std::string::npos)
+                continue;
+
+            auto record = line.substr(0, pos);
+
+            if (line.compare(pos + 1, std::string::npos, checksum(record)) != 0)
+                continue;
+
+            apply(record);
+        }
+    }
+
+    void Journal::compact()
+    {
+        if (entries.empty())
+            return;
+
+        auto tmp = path;
+        tmp += ".";
+        tmp += std::to_string(::getpid());
+
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+
+            auto line = [&](const std::string& record)
+            {
+                out << record << '\t' << checksum(record) << '\n';
+            };
+
+            for (const auto& [key, entry] : entries)
+            {
+                if (!entry.temp.empty())
+                    line("start\t" + key + '\t' + entry.temp.string() + '\t' + entry.final.string());
+
+                if (entry.committed)
+                    line("commit\t" + key + '\t' + std::to_string(entry.committed) + '\t' + entry.validator);
+
+                if (entry.state == Entry::State::done)
+                    line("done\t" + key + '\t' + entry.final.string());
+                else if (entry.state == Entry::State::failed)
+                    line("fail\t" + key + "\t-");
+            }
+
+            out.flush();
+
+            if (!out)
+            {
+                std::string msg = "Unable to write journal '";
+                msg += tmp.string();
+                msg += "'.";
+                throw std::runtime_error(msg);
+            }
+        }
+
+        int tmp_fd = ::open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (tmp_fd >= 0)
+        {
+            ::fdatasync(tmp_fd);
+            ::close(tmp_fd);
+        }
+
+        std::filesystem::rename(tmp, path);
+        sync_directory(path.parent_path());
+    }
+
+    void Journal::append(std::string record, bool now)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        apply(record);
+
+        pending += record;
+        pending += '\t';
+        pending += checksum(record);
+        pending += '\n';
+        ++appended;
+
+        if (now)
+        {
+            urgent = true;
+            cv.notify_one();
+        }
+    }
+
+    void Journal::apply(const std::string& record)
+    {
+        auto fields = split(record);
+
+        if (fields.size() < 3)
+            return;
+
+        const auto& kind = fields[0];
+        auto& entry = entries[fields[1]];
+
+        if (kind == "start" && fields.size() >= 4)
+        {
+            entry = Entry();
+            entry.temp = fields[2];
+            entry.final = fields[3];
+        }
+        else if (kind == "commit")
+        {
+            entry.committed = std::strtoull(fields[2].c_str(), nullptr, 10);
+            entry.validator = fields.size() >= 4 ? fields[3] : std::string();
+        }
+        else if (kind == "done")
+        {
+            entry.state = Entry::State::done;
+            entry.final = fields[2];
+        }
+        else if (kind == "fail")
+        {
+            entry.state = Entry::State::failed;
+        }
+    }
+
+    void Journal::write_pending(std::unique_lock<std::mutex>& lock)
+    {
+        std::string data;
+        data.swap(pending);
+        auto count = appended;
+        urgent = false;
+
+        lock.unlock();
+
+        int err = 0;
+
+        for (size_t written = 0; written < data.length(); )
+        {
+            auto res = ::write(fd, data.data() + written, data.length() - written);
+
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                err = errno;
+                break;
+            }
+
+            written += res;
+        }
+
+        /* one sync for the whole group of records */
+        if (!err && ::fdatasync(fd) < 0)
+            err = errno;
+
+        lock.lock();
+
+        if (err)
+            error = err;
+
+        synced = count;
+        synced_cv.notify_all();
+    }
+
+    void Journal::run() noexcept
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            cv.wait_for(lock, std::chrono::milliseconds(JOURNAL_SYNC_INTERVAL_MS), [&]() { return stopping || urgent; });
+
+            if (!pending.empty())
+                write_pending(lock);
+            else if (stopping)
+                break;
+        }
+    }
+
+    void Journal::fail(const char* what)
+    {
+        std::string msg = "Unable to ";
+        msg += what;
+        msg += " journal '";
+        msg += path.string();
+        msg += "': ";
+        msg += ::strerror(errno);
+        throw std::runtime_error(msg);
+    }
+
+    std::string Journal::checksum(const std::string& record)
+    {
+        /* FNV-1a, enough to tell a torn or garbled line */
+        std::uint32_t hash = 2166136261u;
+
+        for (unsigned char ch : record)
+        {
+            hash ^= ch;
+            hash *= 16777619u;
+        }
+
+        char buff[9];
+        std::snprintf(buff, sizeof(buff), "%08x", hash);
+        return buff;
+    }
+
+    Journal_Sink::Journal_Sink(isink_ptr_t s,
+                               Journal& j,
+                               const std::string& k,
+                               const std::filesystem::path& path,
+                               size_t from,
+                               const std::string& v) :
+        sink(std::move(s)),
+        direct(dynamic_cast<IDirect_Sink*>(sink.get())),
+        journal(j),
+        key(k),
+        validator(v),
+        offset(from),
+        checkpointed(from)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            std::string msg = "Unable to open file '";
+            msg += path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+    }
+
+    Journal_Sink::~Journal_Sink()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void Journal_Sink::reserve(size_t len)
+    {
+        total = offset + len;
+        sink->reserve(len);
+    }
+
+    void Journal_Sink::write(const char* data, size_t len)
+    {
+        sink->write(data, len);
+        advance(len);
+    }
+
+    void Journal_Sink::finish()
+    {
+        sink->finish();
+
+        /* content is on disk before the file is renamed into place */
+        if (::fdatasync(fd) < 0)
+        {
+            std::string msg = "Unable to sync file: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+    }
+
+    char* Journal_Sink::acquire(size_t& len)
+    {
+        return direct ? direct->acquire(len) : nullptr;
+    }
+
+    void Journal_Sink::commit(size_t len)
+    {
+        direct->commit(len);
+        advance(len);
+    }
+
+    void Journal_Sink::advance(size_t len)
+    {
+        offset += len;
+
+        if (offset - checkpointed >= JOURNAL_CHECKPOINT_BYTES)
+            checkpoint();
+    }
+
+    void Journal_Sink::checkpoint()
+    {
+        struct stat st;
+
+        /* what the sink still buffers is not on disk yet */
+        if (::fstat(fd, &st) < 0 || ::fdatasync(fd) < 0)
+        {
+            std::string msg = "Unable to sync file: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        auto committed = std::min<size_t>(offset, st.st_size);
+
+        /* a resumed request for nothing would be refused with 416 */
+        if (total && committed >= total)
+            committed = total - 1;
+
+        journal.committed(key, committed, validator);
+        checkpointed = offset;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "isink.h"
+
+/*
+ * Crash-safe journal of downloads, so an interrupted run can be restarted.
+ *
+ * Append-only text file, one record per line:
+ *     start   key temp final
+ *     commit  key offset validator
+ *     done    key final
+ *     fail    key error
+ * Fields are separated by tabs, every line ends with a checksum of the
+ * record, so a torn last line is ignored. Records are written by a flusher
+ * thread and made durable with fdatasync in groups.
+*/
+
+namespace http
+{
+    class Journal
+    {
+    public:
+        struct Entry
+        {
+            enum class State
+            {
+                started,
+                done,
+                failed
+            };
+
+            State state = State::started;
+            std::filesystem::path temp;
+            std::filesystem::path final;
+            size_t committed = 0;       /* bytes of temp known to be on disk */
+            std::string validator;      /* If-Range for the committed part */
+        };
+
+    public:
+        explicit Journal(const std::filesystem::path& path);
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        std::optional<Entry> find(const std::string& key);
+
+        void started(const std::string& key, const std::filesystem::path& temp, const std::filesystem::path& final);
+        void committed(const std::string& key, size_t offset, const std::string& validator);
+        void done(const std::string& key, const std::filesystem::path& final);
+        void failed(const std::string& key, const std::string& error);
+
+        /* writes pending records and waits until they are on disk */
+        void flush();
+
+        static std::string key(const std::string& url, const std::filesystem::path& destination);
+        static std::filesystem::path temp_path(const std::filesystem::path& final);
+
+    private:
+        void replay();
+        void compact();
+        void append(std::string record, bool now);
+        void apply(const std::string& record);
+        void write_pending(std::unique_lock<std::mutex>& lock);
+        void run() noexcept;
+        [[noreturn]] void fail(const char* what);
+
+        static std::string checksum(const std::string& record);
+
+    private:
+        std::filesystem::path path;
+        int fd = -1;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::condition_variable synced_cv;
+        std::unordered_map<std::string, Entry> entries;
+        std::string pending;
+        size_t appended = 0;        /* records handed to the flusher */
+        size_t synced = 0;          /* records on disk */
+        bool urgent = false;
+        bool stopping = false;
+        int error = 0;
+        std::thread flusher;
+    };
+
+    /*
+     * Passes content to the file sink and periodically records how much of
+     * it is on disk: the file is synced first, then the offset is journaled.
+    */
+    class Journal_Sink : public IDirect_Sink
+    {
+    public:
+        Journal_Sink(isink_ptr_t sink,
+                     Journal& journal,
+                     const std::string& key,
+                     const std::filesystem::path& path,
+                     size_t offset,
+                     const std::string& validator);
+        ~Journal_Sink();
+
+        void reserve(size_t len) override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+        char* acquire(size_t& len) override;
+        void commit(size_t len) override;
+
+    private:
+        void advance(size_t len);
+        void checkpoint();
+
+    private:
+        isink_ptr_t sink;
+        IDirect_Sink* direct;
+        Journal& journal;
+        std::string key;
+        std::string validator;
+        int fd = -1;
+        size_t offset;
+        size_t checkpointed;
+        size_t total = 0;           /* 0 - unknown */
+    };
+}
+
+#endif // JOURNAL_H
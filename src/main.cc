@@ -1,11 +1,54 @@
 #include <getopt.h>
+#include <unistd.h>
 #include <cstring>
 #include <csignal>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
+#include "batch.h"
+#include "daemon.h"
+#include "delta.h"
+#include "mirror.h"
 #include "progress.h"
+#include "stats.h"
+#include "tls.h"
+#include "sinks.h"
 #include "http.h"
 
+#define DEFAULT_TRIES   5
+#define DEFAULT_BLOCK_SIZE  4096
+
+enum
+{
+	OPT_DIRECT = 256,
+	OPT_LOW_SPEED_LIMIT,
+	OPT_LOW_SPEED_TIME,
+	OPT_STALL_TIMEOUT,
+	OPT_JOBS,
+	OPT_HOST_JOBS,
+	OPT_ORDER,
+	OPT_CA_CERTIFICATE,
+	OPT_DELTA,
+	OPT_MAKE_BLOCK_INDEX,
+	OPT_BLOCK_SIZE,
+	OPT_DAEMON,
+	OPT_CLIENT,
+	OPT_SOCKET,
+	OPT_JOURNAL,
+	OPT_H2C,
+	OPT_DEPTH,
+	OPT_PREFIX,
+	OPT_ACCEPT,
+	OPT_REJECT,
+	OPT_STATS,
+	OPT_READ_STATS
+};
+
+/* stops daemon */
+static http::Cancel_Token stop_token;
+
 void show_notification(const char* name) noexcept
 {
 	std::cerr << "Try '" << name << " --help' for more information." << std::endl;
@@ -15,15 +58,64 @@ void show_usage(const char* name) noexcept
 {
 
 	std::cout << "Usage : " << name << " <URL> [OPTION...]" << std::endl
+			  << "        " << name << " -i <MANIFEST> [OPTION...]" << std::endl
+			  << "-c, --cache          Cache directory for conditional requests. Without reflink support" << std::endl
+			  << "                     every cached download is also a full second copy on disk." << std::endl
 			  << "-d, --directory      Download directory." << std::endl
 			  << "-h, --help           Display this help and exit." << std::endl
-			  << "-o, --output         Output file name." << std::endl
-			  << "-r, --rewrite        Rewrite if file exists." << std::endl;
+			  << "-i, --input          Manifest with lines 'URL [size [priority [destination]]]'." << std::endl
+			  << "-k, --insecure       Do not verify server certificate." << std::endl
+			  << "-m, --mmap           Receive directly into memory mapped file." << std::endl
+			  << "-o, --output         Output file name ('-' for standard output)." << std::endl
+			  << "-r, --rewrite        Rewrite if file exists." << std::endl
+			  << "-R, --recursive      Mirror the directory index tree at URL." << std::endl
+			  << "-t, --tries          Number of attempts, interrupted downloads are resumed (default "
+			  << DEFAULT_TRIES << ")." << std::endl
+			  << "-w, --write-behind   Write to disk in a separate thread." << std::endl
+			  << "    --direct           Write bypassing the page cache (O_DIRECT)." << std::endl
+			  << "    --low-speed-limit  Retry if speed is below this number of bytes per second..." << std::endl
+			  << "    --low-speed-time   ...during this number of seconds (default 30)." << std::endl
+			  << "    --stall-timeout    Retry if nothing is received during this number of seconds." << std::endl
+			  << "    --jobs             Manifest, mirror or daemon downloads at once (default 8)." << std::endl
+			  << "    --host-jobs        Manifest downloads at once from one host (default 2)." << std::endl
+			  << "    --order            Manifest order: largest (default), priority or manifest." << std::endl
+			  << "    --ca-certificate   File with CA certificates to verify servers." << std::endl
+			  << "    --delta            Block index (file or URL) of remote file: update the local" << std::endl
+			  << "                       file fetching only changed blocks." << std::endl
+			  << "    --make-block-index Print block index of the given file and exit." << std::endl
+			  << "    --block-size       Block size for --make-block-index (default "
+			  << DEFAULT_BLOCK_SIZE << ")." << std::endl
+			  << "    --daemon           Serve downloads on a local socket until interrupted." << std::endl
+			  << "    --client           Pass the download to a running daemon." << std::endl
+			  << "    --socket           Daemon socket (default " << http::Daemon::default_socket_path().string() << ")." << std::endl
+			  << "    --journal          Journal file: a restarted run skips finished files and resumes partial ones." << std::endl
+			  << "    --h2c              Manifest over cleartext HTTP/2, one multiplexed connection per host." << std::endl
+			  << "    --depth            Levels of listings below URL to follow with -R (default 5)." << std::endl
+			  << "    --prefix           Follow only URLs starting with this (default directory of URL)." << std::endl
+			  << "    --accept           Download only files whose URLs match this regular expression." << std::endl
+			  << "    --reject           Do not download files whose URLs match this regular expression." << std::endl
+			  << "    --stats            Publish live counters in this file (e.g. in /dev/shm)." << std::endl
+			  << "    --read-stats       Print counters published in this file in Prometheus format and exit." << std::endl;
+}
+
+int show_summary(const http::Batch_Summary& summary) noexcept
+{
+	for (const auto& failure : summary.failures)
+	{
+		std::cerr << failure.url << ": " << failure.error << std::endl;
+	}
+
+	std::cout << "Downloaded " << summary.succeeded << " of " << summary.total << " files, "
+			  << summary.bytes << " bytes in "
+			  << std::chrono::duration<double>(summary.elapsed).count() << " s" << std::endl;
+
+	return summary.failures.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 void handler(int)
 {
 	http::Progress::cancel();
+	stop_token.cancel();
 }
 
 int main (int argc, char* argv[])
@@ -47,7 +139,14 @@ int main (int argc, char* argv[])
 	sig.sa_flags |= SA_RESTART;
 #endif /* SA_RESTART */
 
-	if (sigaction (SIGINT, &sig, nullptr) < 0)
+	/* SSL_write uses plain write(), a reset peer must not kill the process */
+	struct sigaction ignore;
+	memset(&ignore, 0, sizeof (struct sigaction));
+	ignore.sa_handler = SIG_IGN;
+
+	if (sigaction (SIGINT, &sig, nullptr) < 0 ||
+		sigaction (SIGTERM, &sig, nullptr) < 0 ||
+		sigaction (SIGPIPE, &ignore, nullptr) < 0)
 	{
 		return EXIT_FAILURE;
 	}
@@ -55,13 +154,62 @@ int main (int argc, char* argv[])
     std::filesystem::path directory;
     std::filesystem::path file_name;
     bool rewrite = false;
+    auto output_mode = http::Output_Mode::stream;
+    std::filesystem::path cache_dir;
+    std::filesystem::path manifest;
+    std::filesystem::path ca_file;
+    bool insecure = false;
+    std::string block_index;
+    std::filesystem::path indexed_file;
+    size_t block_size = DEFAULT_BLOCK_SIZE;
+    bool daemon = false;
+    bool client = false;
+    auto socket_path = http::Daemon::default_socket_path();
+    std::filesystem::path journal_path;
+    http::Batch_Options batch;
+    bool recursive = false;
+    http::Mirror_Options mirror;
+    std::filesystem::path stats_path;
+    std::filesystem::path read_stats_path;
+
+    http::Retry_Policy retry_policy;
+    retry_policy.max_attempts = DEFAULT_TRIES;
 
 	option longopts[] =
 	{
+		{ "cache",		required_argument,	NULL, 'c'},
 		{ "directory",	required_argument,	NULL, 'd'},
 		{ "help",		no_argument,		NULL, 'h'},
+		{ "input",		required_argument,	NULL, 'i'},
+		{ "insecure",	no_argument,		NULL, 'k'},
+		{ "mmap",		no_argument,		NULL, 'm'},
 		{ "output",		required_argument,	NULL, 'o'},
 		{ "rewrite",	no_argument,		NULL, 'r'},
+		{ "recursive",	no_argument,		NULL, 'R'},
+		{ "tries",		required_argument,	NULL, 't'},
+		{ "write-behind",	no_argument,	NULL, 'w'},
+		{ "direct",				no_argument,		NULL, OPT_DIRECT},
+		{ "low-speed-limit",	required_argument,	NULL, OPT_LOW_SPEED_LIMIT},
+		{ "low-speed-time",		required_argument,	NULL, OPT_LOW_SPEED_TIME},
+		{ "stall-timeout",		required_argument,	NULL, OPT_STALL_TIMEOUT},
+		{ "jobs",				required_argument,	NULL, OPT_JOBS},
+		{ "host-jobs",			required_argument,	NULL, OPT_HOST_JOBS},
+		{ "order",				required_argument,	NULL, OPT_ORDER},
+		{ "ca-certificate",		required_argument,	NULL, OPT_CA_CERTIFICATE},
+		{ "delta",				required_argument,	NULL, OPT_DELTA},
+		{ "make-block-index",	required_argument,	NULL, OPT_MAKE_BLOCK_INDEX},
+		{ "block-size",			required_argument,	NULL, OPT_BLOCK_SIZE},
+		{ "daemon",				no_argument,		NULL, OPT_DAEMON},
+		{ "client",				no_argument,		NULL, OPT_CLIENT},
+		{ "socket",				required_argument,	NULL, OPT_SOCKET},
+		{ "journal",			required_argument,	NULL, OPT_JOURNAL},
+		{ "h2c",				no_argument,		NULL, OPT_H2C},
+		{ "depth",				required_argument,	NULL, OPT_DEPTH},
+		{ "prefix",				required_argument,	NULL, OPT_PREFIX},
+		{ "accept",				required_argument,	NULL, OPT_ACCEPT},
+		{ "reject",				required_argument,	NULL, OPT_REJECT},
+		{ "stats",				required_argument,	NULL, OPT_STATS},
+		{ "read-stats",			required_argument,	NULL, OPT_READ_STATS},
 		{ 0, 0, 0, 0 }
 	};
 
@@ -69,13 +217,19 @@ int main (int argc, char* argv[])
 	while (true)
 	{
 		int index;
-		int opt = getopt_long (argc, argv, "d:ho:r", longopts, &index);
+		int opt = getopt_long (argc, argv, "c:d:hi:kmo:rRt:w", longopts, &index);
 
 		if (opt == EOF)
 			break;
 
 		switch (opt)
 		{
+			case 'c':
+			{
+				cache_dir = optarg;
+				break;
+			}
+
 			case 'd':
 			{
 				directory = optarg;
@@ -88,6 +242,24 @@ int main (int argc, char* argv[])
 				return EXIT_SUCCESS;
 			}
 
+			case 'i':
+			{
+				manifest = optarg;
+				break;
+			}
+
+			case 'k':
+			{
+				insecure = true;
+				break;
+			}
+
+			case 'm':
+			{
+				output_mode = http::Output_Mode::mmap;
+				break;
+			}
+
 			case 'o':
 			{
 				file_name = optarg;
@@ -100,6 +272,166 @@ int main (int argc, char* argv[])
 				break;
 			}
 
+			case 't':
+			{
+				retry_policy.max_attempts = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+				break;
+			}
+
+			case 'w':
+			{
+				output_mode = http::Output_Mode::write_behind;
+				break;
+			}
+
+			case OPT_DIRECT:
+			{
+				output_mode = http::Output_Mode::direct;
+				break;
+			}
+
+			case OPT_LOW_SPEED_LIMIT:
+			{
+				retry_policy.low_speed_limit = std::strtoul(optarg, nullptr, 10);
+				break;
+			}
+
+			case OPT_LOW_SPEED_TIME:
+			{
+				retry_policy.low_speed_time = std::chrono::seconds(std::max(1ul, std::strtoul(optarg, nullptr, 10)));
+				break;
+			}
+
+			case OPT_STALL_TIMEOUT:
+			{
+				retry_policy.stall_timeout = std::chrono::seconds(std::max(1ul, std::strtoul(optarg, nullptr, 10)));
+				break;
+			}
+
+			case OPT_JOBS:
+			{
+				batch.global_limit = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+				break;
+			}
+
+			case OPT_HOST_JOBS:
+			{
+				batch.per_host_limit = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+				break;
+			}
+
+			case OPT_ORDER:
+			{
+				if (std::strcmp(optarg, "largest") == 0)
+					batch.order = http::Batch_Options::Order::largest_first;
+				else if (std::strcmp(optarg, "priority") == 0)
+					batch.order = http::Batch_Options::Order::priority;
+				else if (std::strcmp(optarg, "manifest") == 0)
+					batch.order = http::Batch_Options::Order::manifest;
+				else
+				{
+					show_notification(progname);
+					return EXIT_FAILURE;
+				}
+				break;
+			}
+
+			case OPT_CA_CERTIFICATE:
+			{
+				ca_file = optarg;
+				break;
+			}
+
+			case OPT_DELTA:
+			{
+				block_index = optarg;
+				break;
+			}
+
+			case OPT_MAKE_BLOCK_INDEX:
+			{
+				indexed_file = optarg;
+				break;
+			}
+
+			case OPT_BLOCK_SIZE:
+			{
+				block_size = std::max(1ul, std::strtoul(optarg, nullptr, 10));
+				break;
+			}
+
+			case OPT_DAEMON:
+			{
+				daemon = true;
+				break;
+			}
+
+			case OPT_CLIENT:
+			{
+				client = true;
+				break;
+			}
+
+			case OPT_SOCKET:
+			{
+				socket_path = optarg;
+				break;
+			}
+
+			case OPT_JOURNAL:
+			{
+				journal_path = optarg;
+				break;
+			}
+
+			case OPT_H2C:
+			{
+				batch.h2c = true;
+				break;
+			}
+
+			case 'R':
+			{
+				recursive = true;
+				break;
+			}
+
+			case OPT_DEPTH:
+			{
+				mirror.max_depth = std::strtoul(optarg, nullptr, 10);
+				break;
+			}
+
+			case OPT_PREFIX:
+			{
+				mirror.prefix = optarg;
+				break;
+			}
+
+			case OPT_ACCEPT:
+			{
+				mirror.accept = optarg;
+				break;
+			}
+
+			case OPT_REJECT:
+			{
+				mirror.reject = optarg;
+				break;
+			}
+
+			case OPT_STATS:
+			{
+				stats_path = optarg;
+				break;
+			}
+
+			case OPT_READ_STATS:
+			{
+				read_stats_path = optarg;
+				break;
+			}
+
 			default:
 			{
 				show_notification(progname);
@@ -110,20 +442,163 @@ int main (int argc, char* argv[])
 
     try
     {
-        http::Downloader dowloader(std::make_unique<http::Progress>());
-        dowloader.dowload(argv[argc - 1], directory, file_name, rewrite);
+        if (!read_stats_path.empty())
+        {
+            http::Stats::export_prometheus(read_stats_path, std::cout);
+            return EXIT_SUCCESS;
+        }
+
+        if (!stats_path.empty())
+        {
+            http::Stats::shared().open(stats_path);
+        }
+
+        if (!ca_file.empty())
+        {
+            http::Tls_Context::shared().set_ca_file(ca_file);
+        }
+
+        if (insecure)
+        {
+            http::Tls_Context::shared().set_verify(false);
+        }
+
+        if (daemon)
+        {
+            http::Daemon server(socket_path, batch.global_limit);
+            server.set_retry_policy(retry_policy);
+            server.set_output_mode(output_mode);
+            server.run(stop_token);
+            return EXIT_SUCCESS;
+        }
+
+        if (client)
+        {
+            /* daemon has its own working directory */
+            http::Daemon_Request request;
+            request.url = argv[argc - 1];
+            request.directory = std::filesystem::absolute(directory.empty() ? "." : directory);
+            request.file_name = file_name;
+            request.rewrite = rewrite;
+
+            http::Progress progress;
+            http::submit_to_daemon(socket_path, request, &progress);
+            return EXIT_SUCCESS;
+        }
+
+        if (!indexed_file.empty())
+        {
+            http::Block_Index::create(indexed_file, block_size).save(std::cout);
+            return EXIT_SUCCESS;
+        }
+
+        if (!block_index.empty())
+        {
+            std::string url = argv[argc - 1];
+            http::Block_Index index;
+
+            if (block_index.find("://") != std::string::npos)
+            {
+                http::Downloader dowloader(nullptr);
+                dowloader.set_retry_policy(retry_policy);
+                dowloader.set_cancel_token(stop_token);
+                http::Memory_Sink sink;
+                dowloader.dowload(block_index, sink);
+
+                std::istringstream in(std::string(sink.data().begin(), sink.data().end()));
+                index = http::Block_Index::parse(in);
+            }
+            else
+            {
+                std::ifstream in(block_index);
+
+                if (!in.is_open())
+                {
+                    std::cerr << "Unable to open block index '" << block_index << "'." << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                index = http::Block_Index::parse(in);
+            }
+
+            auto local = (directory.empty() ? std::filesystem::path(".") : directory) /
+                         (file_name.empty() ? std::filesystem::path(http::Downloader::create_request_info(url).file_name) : file_name);
+
+            http::Delta_Sync delta(std::make_unique<http::Progress>());
+            auto result = delta.sync(url, local, index);
+
+            std::cout << "Reused " << result.reused << " bytes, fetched " << result.fetched << " bytes." << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        if (!manifest.empty())
+        {
+            batch.directory = directory;
+            batch.rewrite = rewrite;
+            batch.output_mode = output_mode;
+            batch.retry = retry_policy;
+            batch.journal = journal_path;
+            batch.cancel = stop_token;
+
+            http::Batch_Scheduler scheduler(batch);
+            return show_summary(scheduler.run(http::load_manifest(manifest)));
+        }
+
+        if (recursive)
+        {
+            mirror.jobs = batch.global_limit;
+            mirror.directory = directory;
+            mirror.rewrite = rewrite;
+            mirror.output_mode = output_mode;
+            mirror.retry = retry_policy;
+            mirror.cancel = stop_token;
+
+            http::Mirror crawler(mirror);
+            return show_summary(crawler.run(argv[argc - 1]));
+        }
+
+        if (file_name == "-")
+        {
+            /* progress is not shown, because stdout is occupied by content */
+            http::Downloader dowloader(nullptr);
+            dowloader.set_retry_policy(retry_policy);
+            dowloader.set_cancel_token(stop_token);
+            http::Pipe_Sink sink(STDOUT_FILENO);
+            dowloader.dowload(argv[argc - 1], sink);
+        }
+        else
+        {
+            http::Downloader dowloader(std::make_unique<http::Progress>());
+            dowloader.set_output_mode(output_mode);
+            dowloader.set_retry_policy(retry_policy);
+
+            if (!cache_dir.empty())
+            {
+                dowloader.set_cache(std::make_shared<http::Http_Cache>(cache_dir));
+            }
+
+            if (!journal_path.empty())
+            {
+                dowloader.set_journal(std::make_shared<http::Journal>(journal_path));
+            }
+
+            dowloader.dowload(argv[argc - 1], directory, file_name, rewrite);
+        }
     }
     catch (const std::invalid_argument& e)
     {
         std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
     catch (const std::domain_error& e)
     {
         std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
     catch (const std::runtime_error& e)
     {
         std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
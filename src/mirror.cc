@@ -0,0 +1,625 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "http.h"
+#include "mirror.h"
+
+#define LINK_MAX_LENGTH     4096
+#define TAG_MAX_LENGTH      16
+
+namespace http
+{
+    namespace
+    {
+        bool is_space(char ch) noexcept
+        {
+            return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f';
+        }
+
+        /* the few entities autoindex pages put into links */
+        std::string decode_entities(const std::string& value)
+        {
+            if (value.find('&') == std::string::npos)
+                return value;
+
+            static const std::pair<const char*, char> entities[] = {
+                { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&#39;", '\'' }, { "&apos;", '\'' }
+            };
+
+            std::string result;
+
+            for (size_t pos = 0; pos < value.size(); )
+            {
+                auto entity = std::find_if(std::begin(entities), std::end(entities), [&](const auto& e)
+                {
+                    return value.compare(pos, std::strlen(e.first), e.first) == 0;
+                });
+
+                if (value[pos] == '&' && entity != std::end(entities))
+                {
+                    result += entity->second;
+                    pos += std::strlen(entity->first);
+                }
+                else
+                {
+                    result += value[pos++];
+                }
+            }
+
+            return result;
+        }
+
+        std::string percent_decode(std::string_view value)
+        {
+            std::string result;
+
+            for (size_t pos = 0; pos < value.size(); ++pos)
+            {
+                if (value[pos] == '%' && pos + 2 < value.size() &&
+                    std::isxdigit(static_cast<unsigned char>(value[pos + 1])) &&
+                    std::isxdigit(static_cast<unsigned char>(value[pos + 2])))
+                {
+                    result += static_cast<char>(std::stoi(std::string(value.substr(pos + 1, 2)), nullptr, 16));
+                    pos += 2;
+                }
+                else
+                {
+                    result += value[pos];
+                }
+            }
+
+            return result;
+        }
+
+        /* escapes what the URL parser does not accept, e.g. "+ ~ ( ) !" left unescaped by autoindex */
+        std::string percent_encode(std::string_view value, std::string_view allowed)
+        {
+            static const char digits[] = "0123456789ABCDEF";
+            std::string result;
+
+            for (auto ch : value)
+            {
+                auto byte = static_cast<unsigned char>(ch);
+
+                if (std::isalnum(byte) || allowed.find(ch) != std::string_view::npos)
+                {
+                    result += ch;
+                }
+                else
+                {
+                    result += '%';
+                    result += digits[byte >> 4];
+                    result += digits[byte & 0xf];
+                }
+            }
+
+            return result;
+        }
+
+        /* removes "." and ".." segments of the path */
+        std::string remove_dot_segments(std::string_view path)
+        {
+            std::vector<std::string_view> segments;
+            size_t pos = 1;
+
+            while (pos <= path.size())
+            {
+                auto end = std::min(path.find('/', pos), path.size());
+                auto segment = path.substr(pos, end - pos);
+
+                if (segment == "..")
+                {
+                    if (!segments.empty())
+                        segments.pop_back();
+                }
+                else if (segment != ".")
+                {
+                    segments.push_back(segment);
+                }
+
+                /* trailing "." or ".." still means a directory */
+                if (end == path.size() && (segment == "." || segment == ".."))
+                    segments.push_back(std::string_view());
+
+                pos = end + 1;
+            }
+
+            std::string result;
+
+            for (auto segment : segments)
+            {
+                result += '/';
+                result += segment;
+            }
+
+            return result.empty() ? "/" : result;
+        }
+    }
+
+    Link_Sink::Link_Sink(link_handler_t h) :
+        handler(std::move(h))
+    {
+
+    }
+
+    void Link_Sink::reserve(size_t)
+    {
+
+    }
+
+    void Link_Sink::write(const char* data, size_t len)
+    {
+        /* tags may be split between writes, so all the state is kept */
+        for (auto end = data + len; data != end; ++data)
+        {
+            auto ch = *data;
+
+            switch (state)
+            {
+                case State::text:
+                    if (ch == '<')
+                    {
+                        state = State::tag_open;
+                        tag.clear();
+                    }
+                    break;
+
+                case State::tag_open:
+                    if (std::isalpha(static_cast<unsigned char>(ch)))
+                    {
+                        tag += static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+                        state = State::tag_name;
+                    }
+                    else if (ch == '!')
+                    {
+                        dashes = 0;
+                        state = State::markup;
+                    }
+                    else
+                    {
+                        state = ch == '>' ? State::text : State::skip_tag;
+                    }
+                    break;
+
+                case State::tag_name:
+                    if (is_space(ch) || ch == '/')
+                    {
+                        state = tag == "a" ? State::before_attr : State::skip_tag;
+                    }
+                    else if (ch == '>')
+                    {
+                        state = State::text;
+                    }
+                    else if (tag.size() < TAG_MAX_LENGTH)
+                    {
+                        tag += static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+                    }
+                    break;
+
+                case State::markup:
+                    if (ch == '-' && ++dashes == 2)
+                    {
+                        dashes = 0;
+                        state = State::comment;
+                    }
+                    else if (ch != '-')
+                    {
+                        state = ch == '>' ? State::text : State::skip_tag;
+                    }
+                    break;
+
+                case State::comment:
+                    if (ch == '>' && dashes >= 2)
+                        state = State::text;
+                    else
+                        dashes = ch == '-' ? dashes + 1 : 0;
+                    break;
+
+                case State::skip_tag:
+                    if (ch == '>')
+                        state = State::text;
+                    break;
+
+                case State::before_attr:
+                    if (ch == '>')
+                    {
+                        state = State::text;
+                    }
+                    else if (!is_space(ch) && ch != '/')
+                    {
+                        attr.assign(1, static_cast<char>(std::tolower(static_cast<unsigned char>(ch))));
+                        state = State::attr_name;
+                    }
+                    break;
+
+                case State::attr_name:
+                case State::after_attr_name:
+                    if (ch == '=')
+                    {
+                        state = State::before_value;
+                    }
+                    else if (ch == '>')
+                    {
+                        state = State::text;
+                    }
+                    else if (ch == '/')
+                    {
+                        state = State::before_attr;
+                    }
+                    else if (is_space(ch))
+                    {
+                        state = State::after_attr_name;
+                    }
+                    else if (state == State::after_attr_name)
+                    {
+                        /* previous attribute had no value */
+                        attr.assign(1, static_cast<char>(std::tolower(static_cast<unsigned char>(ch))));
+                        state = State::attr_name;
+                    }
+                    else if (attr.size() < TAG_MAX_LENGTH)
+                    {
+                        attr += static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+                    }
+                    break;
+
+                case State::before_value:
+                    value.clear();
+
+                    if (ch == '"' || ch == '\'')
+                    {
+                        quote = ch;
+                        state = State::value_quoted;
+                    }
+                    else if (ch == '>')
+                    {
+                        state = State::text;
+                    }
+                    else if (!is_space(ch))
+                    {
+                        value += ch;
+                        state = State::value_unquoted;
+                    }
+                    break;
+
+                case State::value_quoted:
+                    if (ch == quote)
+                    {
+                        emit();
+                        state = State::before_attr;
+                    }
+                    else if (value.size() <= LINK_MAX_LENGTH)
+                    {
+                        value += ch;
+                    }
+                    break;
+
+                case State::value_unquoted:
+                    if (is_space(ch) || ch == '>')
+                    {
+                        emit();
+                        state = ch == '>' ? State::text : State::before_attr;
+                    }
+                    else if (value.size() <= LINK_MAX_LENGTH)
+                    {
+                        value += ch;
+                    }
+                    break;
+            }
+        }
+    }
+
+    void Link_Sink::finish()
+    {
+
+    }
+
+    void Link_Sink::emit()
+    {
+        /* longer ones are cut, there is nothing to follow */
+        if (attr == "href" && value.size() <= LINK_MAX_LENGTH)
+            handler(decode_entities(value));
+    }
+
+    bool Visited_Set::insert(const std::string& url)
+    {
+        auto& shard = shards[std::hash<std::string>()(url) % std::size(shards)];
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.urls.insert(url).second;
+    }
+
+    Mirror::Mirror(const Mirror_Options& opts) :
+        options(opts)
+    {
+        options.jobs = std::max<size_t>(options.jobs, 1);
+
+        try
+        {
+            if (!options.accept.empty())
+                accept = std::regex(options.accept, std::regex::ECMAScript | std::regex::nosubs);
+
+            if (!options.reject.empty())
+                reject = std::regex(options.reject, std::regex::ECMAScript | std::regex::nosubs);
+        }
+        catch (const std::regex_error& e)
+        {
+            std::string msg = "Invalid pattern: ";
+            msg += e.what();
+            throw std::invalid_argument(msg);
+        }
+    }
+
+    Batch_Summary Mirror::run(const std::string& url)
+    {
+        auto started = std::chrono::steady_clock::now();
+
+        /* throws for a malformed one */
+        Downloader::create_request_info(url);
+
+        auto start = resolve(url, "");
+
+        if (start.empty())
+            throw std::invalid_argument("Invalid URL.");
+
+        /* by default nothing above the start listing is followed */
+        root = options.prefix.empty() ? start.substr(0, start.rfind('/') + 1) : options.prefix;
+
+        visited.insert(start);
+        pages.push_back({ start, 0 });
+
+        std::vector<std::thread> workers;
+
+        for (size_t i = 0; i < options.jobs; ++i)
+            workers.emplace_back(&Mirror::work, this);
+
+        for (auto& w : workers)
+            w.join();
+
+        summary.elapsed = std::chrono::steady_clock::now() - started;
+
+        return summary;
+    }
+
+    std::string Mirror::resolve(const std::string& base, std::string_view href)
+    {
+        while (!href.empty() && is_space(href.front()))
+            href.remove_prefix(1);
+
+        while (!href.empty() && is_space(href.back()))
+            href.remove_suffix(1);
+
+        href = href.substr(0, href.find('#'));
+
+        /* sorting links of autoindex lead to the same listing */
+        if (!href.empty() && href.front() == '?')
+            return std::string();
+
+        auto scheme_end = base.find("://");
+
+        if (scheme_end == std::string::npos)
+            return std::string();
+
+        auto path_start = std::min(base.find('/', scheme_end + 3), base.size());
+        auto base_path = std::string_view(base).substr(path_start);
+        base_path = base_path.substr(0, base_path.find('?'));
+
+        auto colon = href.find(':');
+        std::string url;
+
+        if (colon != std::string::npos && colon < href.find_first_of("/?"))
+        {
+            /* absolute, only http is followed (not mailto:, javascript: and such) */
+            std::string scheme(href.substr(0, colon));
+            str_tolower(scheme);
+
+            if (scheme != "http" && scheme != "https")
+                return std::string();
+
+            url = href;
+        }
+        else if (href.substr(0, 2) == "//")
+        {
+            url = base.substr(0, scheme_end + 1);
+            url += href;
+        }
+        else
+        {
+            url = base.substr(0, path_start);
+
+            if (!href.empty() && href.front() == '/')
+            {
+                url += href;
+            }
+            else
+            {
+                url += base_path.substr(0, base_path.rfind('/') + 1);
+                url += href;
+            }
+        }
+
+        /* normalized, so the visited set sees one URL per resource */
+        scheme_end = url.find("://");
+        path_start = std::min(url.find('/', scheme_end + 3), url.size());
+
+        auto query = std::min(url.find('?', path_start), url.size());
+        auto path = remove_dot_segments(std::string_view(url).substr(path_start, query - path_start));
+
+        std::string result = url.substr(0, path_start);
+        str_tolower(result);
+        result += percent_encode(path, "/.-_%");
+
+        if (query < url.size())
+        {
+            result += '?';
+            result += percent_encode(std::string_view(url).substr(query + 1), ".-_=&,%");
+        }
+
+        return result;
+    }
+
+    void Mirror::work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            cv.wait(lock, [&]() { return !pages.empty() || !files.empty() || active == 0; });
+
+            if (options.cancel.is_canceled())
+            {
+                for (const auto& task : files)
+                    summary.failures.push_back({ task.url, "Canceled." });
+
+                pages.clear();
+                files.clear();
+                cv.notify_all();
+                return;
+            }
+
+            /* nothing is queued and nobody can queue more */
+            if (pages.empty() && files.empty())
+            {
+                cv.notify_all();
+                return;
+            }
+
+            /* listings first, they keep the queue of files filled */
+            bool page = !pages.empty();
+            auto& queue = page ? pages : files;
+            auto task = std::move(queue.front());
+            queue.pop_front();
+
+            ++active;
+            lock.unlock();
+
+            if (page)
+                crawl(task);
+            else
+                fetch(task);
+
+            lock.lock();
+            --active;
+            cv.notify_all();
+        }
+    }
+
+    void Mirror::crawl(const Task& task)
+    {
+        try
+        {
+            Downloader downloader(nullptr);
+            downloader.set_cancel_token(options.cancel);
+            downloader.set_retry_policy(options.retry);
+
+            Link_Sink sink([&](std::string_view href) { discover(task, href); });
+            downloader.dowload(task.url, sink);
+        }
+        catch (const std::exception& e)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            summary.failures.push_back({ task.url, e.what() });
+        }
+    }
+
+    void Mirror::fetch(const Task& task)
+    {
+        try
+        {
+            auto path = local_path(task.url);
+            std::filesystem::create_directories(path.parent_path());
+
+            /* connections to the host are reused through the pool */
+            Downloader downloader(nullptr);
+            downloader.set_cancel_token(options.cancel);
+            downloader.set_output_mode(options.output_mode);
+            downloader.set_retry_policy(options.retry);
+
+            auto result = downloader.dowload(task.url, path.parent_path(), path.filename(), options.rewrite);
+
+            std::error_code ec;
+            auto size = std::filesystem::file_size(result, ec);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++summary.succeeded;
+            summary.bytes += ec ? 0 : size;
+        }
+        catch (const std::exception& e)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            summary.failures.push_back({ task.url, e.what() });
+        }
+    }
+
+    void Mirror::discover(const Task& page, std::string_view href)
+    {
+        auto url = resolve(page.url, href);
+
+        if (url.empty() || url.compare(0, root.size(), root) != 0 || url.size() == root.size())
+            return;
+
+        auto path_end = std::min(url.find('?'), url.size());
+        bool listing = url[path_end - 1] == '/';
+
+        if (listing)
+        {
+            if (page.depth + 1 > options.max_depth)
+                return;
+        }
+        else
+        {
+            if (!options.accept.empty() && !std::regex_search(url, accept))
+                return;
+
+            if (!options.reject.empty() && std::regex_search(url, reject))
+                return;
+        }
+
+        if (!visited.insert(url))
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (listing)
+        {
+            pages.push_back({ std::move(url), page.depth + 1 });
+        }
+        else
+        {
+            files.push_back({ std::move(url), page.depth + 1 });
+            ++summary.total;
+        }
+
+        cv.notify_one();
+    }
+
+    std::filesystem::path Mirror::local_path(const std::string& url) const
+    {
+        auto path = options.directory.empty() ? std::filesystem::path(".") : options.directory;
+        auto relative = std::string_view(url).substr(root.size());
+        relative = relative.substr(0, relative.find('?'));
+
+        for (size_t pos = 0; pos < relative.size(); )
+        {
+            auto end = std::min(relative.find('/', pos), relative.size());
+            auto segment = percent_decode(relative.substr(pos, end - pos));
+
+            if (segment == "." || segment == ".." || segment.find_first_of(std::string("/\0", 2)) != std::string::npos)
+            {
+                std::string msg = "Invalid path in URL: ";
+                msg += url;
+                throw std::invalid_argument(msg);
+            }
+
+            if (!segment.empty())
+                path /= segment;
+
+            pos = end + 1;
+        }
+
+        return path;
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "batch.h"
+#include "cancel.h"
+#include "isink.h"
+#include "retry.h"
+#include "sinks.h"
+
+/*
+ * Recursive mirror of directory index trees (Apache/nginx autoindex).
+ *
+ * URLs ending with '/' are listings: their HTML is tokenized while it is
+ * received and the links are queued. Other URLs are files and are saved
+ * under the same relative path. Listings and files share one pool of
+ * workers, so files are downloaded while the tree is still being crawled.
+*/
+
+namespace http
+{
+    /* streaming tokenizer which reports href of every <a> tag */
+    class Link_Sink : public ISink
+    {
+    public:
+        using link_handler_t = std::function<void(std::string_view)>;
+
+        explicit Link_Sink(link_handler_t handler);
+
+        void reserve(size_t) override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+
+    private:
+        enum class State
+        {
+            text,
+            tag_open,
+            tag_name,
+            markup,
+            comment,
+            skip_tag,
+            before_attr,
+            attr_name,
+            after_attr_name,
+            before_value,
+            value_quoted,
+            value_unquoted
+        };
+
+        void emit();
+
+    private:
+        link_handler_t handler;
+        State state = State::text;
+        std::string tag;
+        std::string attr;
+        std::string value;
+        char quote = 0;
+        unsigned dashes = 0;
+    };
+
+    /* set of URLs shared by the workers, split into shards to keep the locks short */
+    class Visited_Set
+    {
+    public:
+        /* false if it is there already */
+        bool insert(const std::string& url);
+
+    private:
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_set<std::string> urls;
+        };
+
+        Shard shards[16];
+    };
+
+    struct Mirror_Options
+    {
+        unsigned max_depth = 5;             /* listings below the start one */
+        std::string prefix;                 /* empty - directory of the start URL */
+        std::string accept;                 /* regex for file URLs, empty - all */
+        std::string reject;                 /* regex for file URLs, empty - none */
+        size_t jobs = 8;
+        std::filesystem::path directory;
+        bool rewrite = false;
+        Output_Mode output_mode = Output_Mode::stream;
+        Retry_Policy retry;
+        Cancel_Token cancel;                /* stops the crawl, queued files fail */
+    };
+
+    class Mirror
+    {
+    public:
+        explicit Mirror(const Mirror_Options& opts);
+
+        Batch_Summary run(const std::string& url);
+
+        /* absolute URL of href found on page base, empty if it is not http */
+        static std::string resolve(const std::string& base, std::string_view href);
+
+    private:
+        struct Task
+        {
+            std::string url;
+            unsigned depth;
+        };
+
+        void work();
+        void crawl(const Task& task);
+        void fetch(const Task& task);
+        void discover(const Task& page, std::string_view href);
+        std::filesystem::path local_path(const std::string& url) const;
+
+    private:
+        Mirror_Options options;
+        std::regex accept;
+        std::regex reject;
+        std::string root;
+        Visited_Set visited;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Task> pages;
+        std::deque<Task> files;
+        size_t active = 0;
+        Batch_Summary summary;
+    };
+}
+
+#endif // MIRROR_H
@@ -0,0 +1,153 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include "names.h"
+
+#define MAX_FILE_NAME_TRYOUTS   UINT_MAX
+
+namespace http
+{
+    std::filesystem::path Name_Allocator::claim(const std::filesystem::path& dir, const std::filesystem::path& file_name)
+    {
+        if (!std::filesystem::exists(dir))
+        {
+            std::filesystem::create_directories(dir);
+        }
+
+        auto name = file_name.filename();
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& state = scan(dir)[name.string()];
+
+        /* files may have been deleted since they were indexed, the lowest missing one is offered again */
+        for (auto it = state.taken.begin(); it != state.taken.end() && *it < state.lowest_free; )
+        {
+            std::error_code ec;
+
+            if (std::filesystem::exists(std::filesystem::symlink_status(dir / candidate(name, *it), ec)))
+            {
+                ++it;
+                continue;
+            }
+
+            state.lowest_free = *it;
+            state.taken.erase(it);
+            break;
+        }
+
+        while (state.lowest_free < MAX_FILE_NAME_TRYOUTS)
+        {
+            auto index = state.lowest_free;
+            auto path = dir / candidate(name, index);
+
+            state.taken.insert(index);
+
+            while (state.taken.count(state.lowest_free))
+                ++state.lowest_free;
+
+            /* the index may be stale, creation decides */
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+            if (fd >= 0)
+            {
+                ::close(fd);
+                return path;
+            }
+
+            if (errno != EEXIST)
+            {
+                std::string msg = "Unable to create file '";
+                msg += path.string();
+                msg += "': ";
+                msg += ::strerror(errno);
+                throw std::runtime_error(msg);
+            }
+        }
+
+        std::string msg = "Unable to obtain unique name for file '";
+        msg += file_name;
+        msg += "'. Try to change download directory.";
+        throw std::runtime_error(msg);
+    }
+
+    Name_Allocator& Name_Allocator::shared()
+    {
+        static Name_Allocator allocator;
+        return allocator;
+    }
+
+    Name_Allocator::directory_index_t& Name_Allocator::scan(const std::filesystem::path& dir)
+    {
+        auto key = std::filesystem::weakly_canonical(dir).string();
+        auto it = directories.find(key);
+
+        if (it != directories.end())
+            return it->second;
+
+        auto& index = directories[key];
+        std::error_code ec;
+
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+        {
+            std::string base;
+            unsigned i = 0;
+            parse(entry.path().filename().string(), base, i);
+
+            auto& state = index[base];
+            state.taken.insert(i);
+
+            while (state.taken.count(state.lowest_free))
+                ++state.lowest_free;
+        }
+
+        return index;
+    }
+
+    std::string Name_Allocator::candidate(const std::filesystem::path& file_name, unsigned index)
+    {
+        if (index == 0)
+            return file_name.string();
+
+        auto name = file_name.stem().string();
+        name += " (";
+        name += std::to_string(index);
+        name += ")";
+        name += file_name.extension().string();
+        return name;
+    }
+
+    void Name_Allocator::parse(const std::string& name, std::string& base, unsigned& index)
+    {
+        /* "stem (N).ext" belongs to "stem.ext" */
+        std::filesystem::path path(name);
+        auto stem = path.stem().string();
+        auto open = stem.rfind(" (");
+
+        base = name;
+        index = 0;
+
+        if (open == std::string::npos || stem.back() != ')')
+            return;
+
+        auto digits = stem.substr(open + 2, stem.length() - open - 3);
+
+        if (digits.empty() ||
+            digits.length() > 10 ||
+            digits[0] == '0' ||
+            digits.find_first_not_of("0123456789") != std::string::npos)
+            return;
+
+        auto value = std::strtoull(digits.c_str(), nullptr, 10);
+
+        if (value >= MAX_FILE_NAME_TRYOUTS)
+            return;
+
+        base = stem.substr(0, open) + path.extension().string();
+        index = static_cast<unsigned>(value);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef NAMES_H
+#define NAMES_H
+
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace http
+{
+    /*
+     * Allocates distinct file names "name", "name (1)", "name (2)"... in
+     * download directories. Every directory is scanned once into an index,
+     * names deleted later are found again at claim time; names are claimed
+     * by creating the file with O_CREAT | O_EXCL, so concurrent processes
+     * sharing a directory never get the same one.
+    */
+    class Name_Allocator
+    {
+    public:
+        std::filesystem::path claim(const std::filesystem::path& dir, const std::filesystem::path& file_name);
+
+        static Name_Allocator& shared();
+
+    private:
+        struct Name_State
+        {
+            std::set<unsigned> taken;
+            unsigned lowest_free = 0;
+        };
+
+        using directory_index_t = std::unordered_map<std::string, Name_State>;
+
+        directory_index_t& scan(const std::filesystem::path& dir);
+
+        static std::string candidate(const std::filesystem::path& file_name, unsigned index);
+        static void parse(const std::string& name, std::string& base, unsigned& index);
+
+    private:
+        std::mutex mutex;
+        std::unordered_map<std::string, directory_index_t> directories;
+    };
+}
+
+#endif // NAMES_H
@@ -0,0 +1,99 @@
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+
+#include "pool.h"
+
+#define POOL_MAX_IDLE_PER_HOST  8
+#define POOL_IDLE_TIMEOUT_S     30
+
+namespace http
+{
+    Connection_Pool::~Connection_Pool()
+    {
+        for (auto& [key, list] : idle_list)
+        {
+            for (auto& idle : list)
+                discard(idle);
+        }
+    }
+
+    std::optional<Connection_Pool::Idle> Connection_Pool::take(const std::string& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = idle_list.find(key);
+
+        if (it == idle_list.end())
+            return std::nullopt;
+
+        auto& list = it->second;
+        auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(POOL_IDLE_TIMEOUT_S);
+
+        /* most recently used first, it is the least likely to be closed by server */
+        while (!list.empty())
+        {
+            auto idle = std::move(list.back());
+            list.pop_back();
+
+            if (idle.since > deadline && alive(idle))
+                return idle;
+
+            discard(idle);
+        }
+
+        return std::nullopt;
+    }
+
+    void Connection_Pool::put(const std::string& key, Idle idle)
+    {
+        idle.since = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& list = idle_list[key];
+        list.push_back(std::move(idle));
+
+        if (list.size() > POOL_MAX_IDLE_PER_HOST)
+        {
+            discard(list.front());
+            list.pop_front();
+        }
+    }
+
+    std::string Connection_Pool::key(const std::string& host, std::uint16_t port, bool secure)
+    {
+        std::string key = secure ? "https://" : "http://";
+        key += host;
+        key += ':';
+        key += std::to_string(port);
+        return key;
+    }
+
+    Connection_Pool& Connection_Pool::shared()
+    {
+        static Connection_Pool pool;
+        return pool;
+    }
+
+    bool Connection_Pool::alive(const Idle& idle) noexcept
+    {
+        /* idle connection has nothing to read, closed one reads end of file */
+        char c;
+        auto res = ::recv(idle.sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+        return res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    void Connection_Pool::discard(Idle& idle) noexcept
+    {
+        idle.tls.reset();
+
+        if (idle.sock >= 0)
+        {
+            ::close(idle.sock);
+            idle.sock = -1;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <netinet/in.h>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "tls.h"
+
+namespace http
+{
+    /*
+     * Idle keep-alive connections per host, port and scheme. A connection
+     * is put back only after its response has been read completely.
+    */
+    class Connection_Pool
+    {
+    public:
+        struct Idle
+        {
+            int sock = -1;
+            std::unique_ptr<Tls_Session> tls;
+            in_addr peer {};
+            std::chrono::steady_clock::time_point since;
+        };
+
+    public:
+        ~Connection_Pool();
+
+        std::optional<Idle> take(const std::string& key);
+        void put(const std::string& key, Idle idle);
+
+        static std::string key(const std::string& host, std::uint16_t port, bool secure);
+        static Connection_Pool& shared();
+
+    private:
+        static bool alive(const Idle& idle) noexcept;
+        static void discard(Idle& idle) noexcept;
+
+    private:
+        std::mutex mutex;
+        std::unordered_map<std::string, std::deque<Idle>> idle_list;
+    };
+}
+
+#endif // POOL_H
@@ -0,0 +1,265 @@
+#include <netdb.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+
+#include "protocol.h"
+
+#define DNS_CACHE_TTL_S     60
+
+namespace http
+{
+    namespace
+    {
+        struct Dns_Entry
+        {
+            std::vector<in_addr> addrs;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        std::mutex dns_mutex;
+        std::unordered_map<std::string, Dns_Entry> dns_cache;
+    }
+
+    void str_tolower(std::string& str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(),
+            [](unsigned char c){ return std::tolower(c); });
+    }
+
+    in_addr resolve_name(const std::string& hostname)
+    {
+        return resolve_names(hostname).front();
+    }
+
+    std::vector<in_addr> resolve_names(const std::string& hostname)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock(dns_mutex);
+
+            auto it = dns_cache.find(hostname);
+
+            if (it != dns_cache.end() && it->second.expires > now)
+                return it->second.addrs;
+        }
+
+        addrinfo hint {0, AF_INET, SOCK_STREAM, 0, 0, nullptr, nullptr, nullptr};
+        addrinfo* info = nullptr;
+
+        auto result = ::getaddrinfo (hostname.c_str (), nullptr, &hint, &info);
+
+        if (result)
+        {
+            std::string msg = "Can't resolve host name.";
+            throw std::runtime_error(msg);
+        }
+
+        std::vector<in_addr> addrs;
+
+        for (auto ai = info; ai; ai = ai->ai_next)
+        {
+            addrs.push_back(reinterpret_cast<sockaddr_in*>(ai->ai_addr)->sin_addr);
+        }
+
+        ::freeaddrinfo(info);
+
+        std::lock_guard<std::mutex> lock(dns_mutex);
+        dns_cache[hostname] = Dns_Entry{ addrs, now + std::chrono::seconds(DNS_CACHE_TTL_S) };
+
+        return addrs;
+    }
+
+    Status_Line parse_status_line(std::string_view status_line)
+    {
+        size_t len = status_line.length();
+        size_t s = 0;
+        size_t e;
+
+        Status_Line status;
+
+        while (s < len && std::isspace(status_line[s])) ++s;
+
+        e = s;
+        while (e < len && !std::isspace(status_line[e])) ++e;
+
+        status.protocol_version = status_line.substr(s, e - s);
+
+        s = e;
+        while (s < len && std::isspace(status_line[s])) ++s;
+
+        e = s;
+        while (e < len && !std::isspace(status_line[e])) ++e;
+
+        status.status_code = 0;
+        std::from_chars(status_line.data() + s, status_line.data() + e, status.status_code);
+
+        s = e;
+        while (s < len && std::isspace(status_line[s])) ++s;
+
+        status.status_text = status_line.substr(s);
+
+        return status;
+    }
+
+    header_list_t parse_headers(std::string_view headers)
+    {
+        header_list_t list;
+
+        size_t len = headers.length();
+        size_t i = 0;
+
+        bool key_part = true;
+        bool end_line = false;
+        bool space = false;
+        bool inside = false;
+        std::string key;
+        std::string val;
+
+        while (i < len)
+        {
+            auto ch = headers[i];
+
+            switch (ch)
+            {
+                case ':':
+                {
+                    if (key_part)
+                    {
+                        key_part = false;
+
+                        /* skip spaces */
+                        inside = false;
+                        space = false;
+                    }
+                    else
+                    {
+                        val.push_back(ch);
+                    }
+
+                    break;
+                }
+
+                case '\r':
+                {
+                    end_line = true;
+                    break;
+                }
+
+                case '\n':
+                {
+                    if (!end_line)
+                    {
+                        std::string msg = "Invalid server response: Unable to parse headers.";
+                        throw std::runtime_error(msg);
+                    }
+
+                    end_line = false;
+                    key_part = true;
+
+                    if (!key.empty()) {
+                        str_tolower(key);
+                        list.insert(std::pair{ std::move(key), std::move(val) });
+                    }
+
+                    /* skip spaces */
+                    inside = false;
+                    space = false;
+                    break;
+                }
+
+                case '\t':
+                case ' ':
+                {
+                    /* normalize spacing */
+                    if (inside)
+                        space = true;
+
+                    break;
+                }
+
+                default:
+                {
+                    inside = true;
+
+                    if (key_part)
+                    {
+                        if (space)
+                        {
+                            key.push_back(' ');
+                            space = false;
+                        }
+
+                        key.push_back(ch);
+                    }
+                    else
+                    {
+                        if (space)
+                        {
+                            val.push_back(' ');
+                            space = false;
+                        }
+
+                        val.push_back(ch);
+                    }
+                }
+            }
+
+            ++i;
+        }
+
+        return list;
+    }
+
+    bool is_redirect(unsigned status_code) noexcept
+    {
+        return status_code == 301 ||
+               status_code == 302 ||
+               status_code == 303 ||
+               status_code == 305 ||
+               status_code == 307 ||
+               status_code == 308;
+    }
+
+    std::string unsuccessful_status_message(const Status_Line& status, const header_list_t& headers)
+    {
+        std::string msg = "Unsuccessful request. Status code: ";
+        msg += std::to_string(status.status_code);
+        msg += ' ';
+        msg += status.status_text;
+        msg += '.';
+
+        if (is_redirect(status.status_code))
+        {
+            auto it = headers.find("location");
+
+            if (it != headers.end())
+            {
+                msg += " New location: ";
+                msg += it->second;
+            }
+        }
+
+        return msg;
+    }
+
+    size_t content_range_start(const header_list_t& headers)
+    {
+        /* Content-Range: bytes first-last/complete */
+        auto it = headers.find("content-range");
+
+        if (it == headers.end())
+            return 0;
+
+        auto pos = it->second.find_first_of("0123456789");
+
+        if (pos == std::string::npos)
+            return 0;
+
+        return std::strtoull(it->second.c_str() + pos, nullptr, 10);
+    }
+}
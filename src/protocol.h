@@ -0,0 +1,61 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <netinet/in.h>
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define DOWNLOAD_RCV_TIMEOUT_S  5
+#define DOWNLOAD_CONNECT_TIMEOUT_S  10
+
+/*
+ * HTTP/1.1 message syntax helpers shared by blocking and coroutine based
+ * connections.
+*/
+
+namespace http
+{
+    struct Status_Line
+    {
+        std::string protocol_version;
+        unsigned status_code;
+        std::string status_text;
+    };
+
+    using header_list_t = std::unordered_multimap<std::string, std::string>;
+
+    /* network failure, the request may be repeated */
+    class Transfer_Error : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    class Status_Error : public std::runtime_error
+    {
+    public:
+        Status_Error(unsigned code, const std::string& msg) :
+            std::runtime_error(msg),
+            status_code(code)
+        {
+
+        }
+
+        const unsigned status_code;
+    };
+
+    void str_tolower(std::string& str);
+    in_addr resolve_name(const std::string& hostname);
+    std::vector<in_addr> resolve_names(const std::string& hostname);
+    Status_Line parse_status_line(std::string_view status_line);
+    header_list_t parse_headers(std::string_view headers);
+    bool is_redirect(unsigned status_code) noexcept;
+    std::string unsuccessful_status_message(const Status_Line& status, const header_list_t& headers);
+    size_t content_range_start(const header_list_t& headers);
+}
+
+#endif // PROTOCOL_H
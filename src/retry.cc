@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+
+#include "retry.h"
+
+namespace http
+{
+    std::chrono::milliseconds Retry_Policy::delay(unsigned attempt) const
+    {
+        thread_local std::mt19937 generator(std::random_device{}());
+
+        auto base = initial_delay.count() * std::pow(multiplier, attempt > 0 ? attempt - 1 : 0);
+        base = std::min(base, static_cast<double>(max_delay.count()));
+
+        auto spread = std::clamp(jitter, 0.0, 1.0) * base;
+        std::uniform_real_distribution<double> distribution(base - spread, base);
+
+        return std::chrono::milliseconds(static_cast<long long>(distribution(generator)));
+    }
+
+    bool Retry_Policy::is_retryable_status(unsigned status_code) noexcept
+    {
+        return status_code == 408 ||
+               status_code == 429 ||
+               status_code == 500 ||
+               status_code == 502 ||
+               status_code == 503 ||
+               status_code == 504;
+    }
+
+    Speed_Monitor::Speed_Monitor(size_t l, std::chrono::seconds w) noexcept :
+        limit(l),
+        window(w)
+    {
+
+    }
+
+    void Speed_Monitor::add(size_t bytes)
+    {
+        if (limit == 0)
+            return;
+
+        window_bytes += bytes;
+
+        auto now = clock_t::now();
+        auto elapsed = now - window_start;
+
+        if (elapsed < window)
+            return;
+
+        auto seconds = std::chrono::duration<double>(elapsed).count();
+        auto speed = window_bytes / seconds;
+
+        if (speed < limit)
+        {
+            std::string msg = "Transfer is too slow: ";
+            msg += std::to_string(static_cast<size_t>(speed));
+            msg += " bytes/s during ";
+            msg += std::to_string(window.count());
+            msg += " s.";
+            throw Transfer_Error(msg);
+        }
+
+        window_start = now;
+        window_bytes = 0;
+    }
+}
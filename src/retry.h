@@ -0,0 +1,45 @@
+#ifndef RETRY_H
+#define RETRY_H
+
+#include <chrono>
+#include <cstddef>
+
+#include "protocol.h"
+
+namespace http
+{
+    struct Retry_Policy
+    {
+        unsigned max_attempts = 1;
+        std::chrono::milliseconds initial_delay { 500 };
+        std::chrono::milliseconds max_delay { 30000 };
+        double multiplier = 2.0;
+        double jitter = 0.5;                                /* fraction of delay randomized */
+        std::chrono::seconds stall_timeout { DOWNLOAD_RCV_TIMEOUT_S };
+        size_t low_speed_limit = 0;                         /* bytes per second, 0 - disabled */
+        std::chrono::seconds low_speed_time { 30 };
+
+        std::chrono::milliseconds delay(unsigned attempt) const;
+        static bool is_retryable_status(unsigned status_code) noexcept;
+    };
+
+    /* aborts a transfer which stays below the speed limit during the whole window */
+    class Speed_Monitor
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        Speed_Monitor() noexcept = default;
+        Speed_Monitor(size_t limit, std::chrono::seconds window) noexcept;
+
+        void add(size_t bytes);
+
+    private:
+        size_t limit = 0;
+        std::chrono::seconds window { 0 };
+        clock_t::time_point window_start = clock_t::now();
+        size_t window_bytes = 0;
+    };
+}
+
+#endif // RETRY_H
@@ -0,0 +1,338 @@
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "scheduler.h"
+
+#define SCHEDULER_MAX_EVENTS    64
+
+namespace http
+{
+    Scheduler::Scheduler(size_t threads)
+    {
+        epfd = ::epoll_create1(EPOLL_CLOEXEC);
+
+        if (epfd < 0)
+        {
+            std::string msg = "Unable to create epoll instance: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        evfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (evfd < 0)
+        {
+            ::close(epfd);
+            std::string msg = "Unable to create eventfd: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = evfd;
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back(&Scheduler::run, this);
+    }
+
+    Scheduler::~Scheduler()
+    {
+        stop();
+        ::close(evfd);
+        ::close(epfd);
+    }
+
+    Scheduler::Schedule_Awaiter Scheduler::schedule() noexcept
+    {
+        return Schedule_Awaiter{ *this };
+    }
+
+    Scheduler::Io_Awaiter Scheduler::readable(int fd, int timeout_ms) noexcept
+    {
+        return Io_Awaiter{ *this, fd, EPOLLIN | EPOLLRDHUP, timeout_ms };
+    }
+
+    Scheduler::Io_Awaiter Scheduler::writable(int fd, int timeout_ms) noexcept
+    {
+        return Io_Awaiter{ *this, fd, EPOLLOUT, timeout_ms };
+    }
+
+    Scheduler::Offload_Awaiter Scheduler::offload(std::function<void()> work) noexcept
+    {
+        return Offload_Awaiter{ *this, std::move(work) };
+    }
+
+    void Scheduler::release(int fd) noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (registered.erase(fd))
+            ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    void Scheduler::stop() noexcept
+    {
+        if (stopping.exchange(true))
+            return;
+
+        wakeup();
+
+        for (auto& worker : workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+
+        /* resumed coroutines fail on their next wait, helpers are waited for */
+        std::vector<std::coroutine_handle<>> resumable;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            for (auto& [fd, awaiter] : waiters)
+            {
+                awaiter->stopped = true;
+                resumable.push_back(awaiter->handle);
+            }
+
+            waiters.clear();
+            timers.clear();
+
+            resumable.insert(resumable.end(), ready.begin(), ready.end());
+            ready.clear();
+
+            if (resumable.empty())
+            {
+                if (offloads == 0)
+                    break;
+
+                offloads_cv.wait(lock);
+                continue;
+            }
+
+            lock.unlock();
+
+            for (auto h : resumable)
+                h.resume();
+
+            resumable.clear();
+            lock.lock();
+        }
+    }
+
+    void Scheduler::post(std::coroutine_handle<> h)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(h);
+        }
+
+        wakeup();
+    }
+
+    void Scheduler::wait(Io_Awaiter* awaiter)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (stopping)
+            throw std::runtime_error("Scheduler is stopped.");
+
+        epoll_event ev {};
+        ev.events = awaiter->events | EPOLLONESHOT;
+        ev.data.fd = awaiter->fd;
+
+        auto op = registered.count(awaiter->fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        if (::epoll_ctl(epfd, op, awaiter->fd, &ev) < 0)
+        {
+            std::string msg = "Unable to wait for socket: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        registered.insert(awaiter->fd);
+        waiters[awaiter->fd] = awaiter;
+
+        if (awaiter->timeout_ms >= 0)
+        {
+            auto deadline = clock_t::now() + std::chrono::milliseconds(awaiter->timeout_ms);
+            awaiter->timer = timers.emplace(deadline, awaiter->fd);
+
+            /* workers may sleep with a later deadline */
+            if (awaiter->timer == timers.begin())
+                wakeup();
+        }
+        else
+        {
+            awaiter->timer = timers.end();
+        }
+    }
+
+    void Scheduler::spawn(Offload_Awaiter* awaiter)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (stopping)
+                throw std::runtime_error("Scheduler is stopped.");
+
+            ++offloads;
+        }
+
+        auto helper = [this, awaiter]
+        {
+            try
+            {
+                awaiter->work();
+            }
+            catch (...)
+            {
+                awaiter->error = std::current_exception();
+            }
+
+            /* under the lock, stop() may destroy the scheduler right after */
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(awaiter->handle);
+            --offloads;
+            offloads_cv.notify_all();
+            wakeup();
+        };
+
+        try
+        {
+            std::thread(std::move(helper)).detach();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --offloads;
+            throw;
+        }
+    }
+
+    void Scheduler::wakeup() noexcept
+    {
+        std::uint64_t one = 1;
+        auto res = ::write(evfd, &one, sizeof(one));
+        (void) res;
+    }
+
+    int Scheduler::next_timeout_ms()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (timers.empty())
+            return -1;
+
+        auto left = timers.begin()->first - clock_t::now();
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(left).count();
+
+        return ms > 0 ? static_cast<int>(ms) : 0;
+    }
+
+    void Scheduler::run() noexcept
+    {
+        epoll_event events[SCHEDULER_MAX_EVENTS];
+        std::vector<std::coroutine_handle<>> resumable;
+
+        while (!stopping)
+        {
+            auto n = ::epoll_wait(epfd, events, SCHEDULER_MAX_EVENTS, next_timeout_ms());
+
+            if (n < 0 && errno != EINTR)
+                break;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (int i = 0; i < n; ++i)
+                {
+                    auto fd = events[i].data.fd;
+
+                    if (fd == evfd)
+                    {
+                        /* keep eventfd signaled on stop, so every worker wakes up */
+                        if (!stopping)
+                        {
+                            std::uint64_t val;
+                            auto res = ::read(evfd, &val, sizeof(val));
+                            (void) res;
+                        }
+
+                        continue;
+                    }
+
+                    auto it = waiters.find(fd);
+
+                    if (it == waiters.end())
+                        continue;
+
+                    auto awaiter = it->second;
+                    waiters.erase(it);
+
+                    if (awaiter->timer != timers.end())
+                        timers.erase(awaiter->timer);
+
+                    resumable.push_back(awaiter->handle);
+                }
+
+                auto now = clock_t::now();
+
+                while (!timers.empty() && timers.begin()->first <= now)
+                {
+                    auto fd = timers.begin()->second;
+                    timers.erase(timers.begin());
+
+                    auto it = waiters.find(fd);
+
+                    if (it == waiters.end())
+                        continue;
+
+                    auto awaiter = it->second;
+                    waiters.erase(it);
+
+                    /* disarm, the socket stays registered for later waits */
+                    epoll_event ev {};
+                    ::epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+
+                    awaiter->timed_out = true;
+                    resumable.push_back(awaiter->handle);
+                }
+            }
+
+            for (auto h : resumable)
+                h.resume();
+
+            resumable.clear();
+
+            while (true)
+            {
+                std::coroutine_handle<> h;
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    if (ready.empty())
+                        break;
+
+                    h = ready.front();
+                    ready.pop_front();
+                }
+
+                h.resume();
+            }
+        }
+    }
+}
@@ -0,0 +1,222 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "task.h"
+
+/*
+ * Runs coroutines on a small pool of threads sharing one epoll instance.
+ * Coroutines suspend on socket readiness instead of blocking a thread.
+*/
+
+namespace http
+{
+    class Scheduler
+    {
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        struct Schedule_Awaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                scheduler.post(h);
+            }
+
+            void await_resume() const noexcept
+            {
+
+            }
+
+            Scheduler& scheduler;
+        };
+
+        struct Io_Awaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                handle = h;
+                scheduler.wait(this);
+            }
+
+            /* false if timeout is expired */
+            bool await_resume() const
+            {
+                if (stopped)
+                    throw std::runtime_error("Scheduler is stopped.");
+
+                return !timed_out;
+            }
+
+            Scheduler& scheduler;
+            int fd;
+            std::uint32_t events;
+            int timeout_ms;
+            bool timed_out = false;
+            bool stopped = false;
+            std::coroutine_handle<> handle;
+            std::multimap<clock_t::time_point, int>::iterator timer;
+        };
+
+        /* blocking work (e.g. name resolution) on a helper thread, the coroutine resumes on a worker */
+        struct Offload_Awaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                handle = h;
+                scheduler.spawn(this);
+            }
+
+            void await_resume() const
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            Scheduler& scheduler;
+            std::function<void()> work;
+            std::exception_ptr error;
+            std::coroutine_handle<> handle;
+        };
+
+    public:
+        explicit Scheduler(size_t threads = 0);
+        ~Scheduler();
+
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+
+        Schedule_Awaiter schedule() noexcept;
+        Io_Awaiter readable(int fd, int timeout_ms) noexcept;
+        Io_Awaiter writable(int fd, int timeout_ms) noexcept;
+        Offload_Awaiter offload(std::function<void()> work) noexcept;
+        void release(int fd) noexcept;
+
+        template<typename T>
+        std::future<T> start(Task<T> task);
+
+        /* suspended coroutines are resumed with an error, so their futures complete */
+        void stop() noexcept;
+
+    private:
+        struct Detached
+        {
+            struct promise_type
+            {
+                Detached get_return_object() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() noexcept
+                {
+                    return {};
+                }
+
+                void return_void() noexcept
+                {
+
+                }
+
+                void unhandled_exception() noexcept
+                {
+                    std::terminate();
+                }
+            };
+        };
+
+        template<typename T>
+        static Detached run_detached(Scheduler& scheduler, Task<T> task, std::promise<T> promise);
+
+        void post(std::coroutine_handle<> h);
+        void wait(Io_Awaiter* awaiter);
+        void spawn(Offload_Awaiter* awaiter);
+        void wakeup() noexcept;
+        int next_timeout_ms();
+        void run() noexcept;
+
+    private:
+        int epfd = -1;
+        int evfd = -1;
+        std::mutex mutex;
+        std::deque<std::coroutine_handle<>> ready;
+        std::unordered_map<int, Io_Awaiter*> waiters;
+        std::multimap<clock_t::time_point, int> timers;
+        std::unordered_set<int> registered;
+        std::vector<std::thread> workers;
+        size_t offloads = 0;                    /* helper threads still running */
+        std::condition_variable offloads_cv;
+        std::atomic_bool stopping = false;
+    };
+
+    template<typename T>
+    std::future<T> Scheduler::start(Task<T> task)
+    {
+        if (stopping)
+            throw std::runtime_error("Scheduler is stopped.");
+
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        run_detached(*this, std::move(task), std::move(promise));
+        return future;
+    }
+
+    template<typename T>
+    Scheduler::Detached Scheduler::run_detached(Scheduler& scheduler, Task<T> task, std::promise<T> promise)
+    {
+        co_await scheduler.schedule();
+
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                co_await task;
+                promise.set_value();
+            }
+            else
+            {
+                promise.set_value(co_await task);
+            }
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+}
+
+#endif // SCHEDULER_H
@@ -0,0 +1,786 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "sinks.h"
+
+#define PIPE_SINK_DEFAULT_SIZE  65536
+#define WRITE_BEHIND_ALIGNMENT  4096
+#define DIRECT_IO_ALIGNMENT     4096
+
+namespace http
+{
+    File_Sink::File_Sink(const std::filesystem::path& p, bool append) :
+        path(p),
+        of(p, std::ios::binary | (append ? std::ios::app : std::ios::trunc))
+    {
+        if (!of.is_open())
+        {
+            std::string msg = "Unable to open file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+    }
+
+    void File_Sink::reserve(size_t) noexcept
+    {
+
+    }
+
+    void File_Sink::write(const char* data, size_t len)
+    {
+        of.write(data, len);
+    }
+
+    void File_Sink::finish()
+    {
+        of.flush();
+
+        if (!of)
+        {
+            std::string msg = "Unable to write file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+    }
+
+    Mmap_Sink::Mmap_Sink(const std::filesystem::path& p) :
+        Mmap_Sink(p, Options())
+    {
+
+    }
+
+    Mmap_Sink::Mmap_Sink(const std::filesystem::path& p, const Options& opts) :
+        path(p),
+        options(opts)
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            std::string msg = "Unable to open file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+    }
+
+    Mmap_Sink::~Mmap_Sink()
+    {
+        unmap();
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void Mmap_Sink::reserve(size_t len)
+    {
+        if (map || len == 0)
+            return;
+
+        /* blocks are allocated up front, a sparse mapping would raise SIGBUS on a full disk */
+        if (int err = ::posix_fallocate(fd, 0, len))
+        {
+            errno = err;
+            fail("allocate");
+        }
+
+        auto addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (addr == MAP_FAILED)
+            fail("map");
+
+        map = static_cast<char*>(addr);
+        size = len;
+
+        if (options.advice != MADV_NORMAL)
+            ::madvise(map, size, options.advice);
+    }
+
+    void Mmap_Sink::write(const char* data, size_t len)
+    {
+        if (!map)
+        {
+            while (len)
+            {
+                auto n = ::write(fd, data, len);
+
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    fail("write");
+                }
+
+                data += n;
+                len -= n;
+            }
+
+            return;
+        }
+
+        if (len > size - offset)
+        {
+            std::string msg = "Content exceeds size of file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+
+        std::memcpy(map + offset, data, len);
+        commit(len);
+    }
+
+    void Mmap_Sink::finish()
+    {
+        if (map)
+        {
+            if (options.sync_on_finish)
+                sync(0, offset, MS_SYNC);
+
+            unmap();
+
+            /* content is shorter than announced */
+            if (offset < size && ::ftruncate(fd, offset) < 0)
+                fail("size");
+        }
+    }
+
+    char* Mmap_Sink::acquire(size_t& len) noexcept
+    {
+        if (!map || offset == size)
+            return nullptr;
+
+        len = std::min(len, size - offset);
+        return map + offset;
+    }
+
+    void Mmap_Sink::commit(size_t len)
+    {
+        offset += len;
+
+        if (options.sync_interval && offset - synced >= options.sync_interval)
+        {
+            sync(synced, offset, MS_ASYNC);
+            synced = offset;
+        }
+    }
+
+    void Mmap_Sink::sync(size_t from, size_t to, int flags)
+    {
+        static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+
+        /* msync requires page aligned address */
+        from = from / page_size * page_size;
+
+        if (to > from && ::msync(map + from, to - from, flags) < 0)
+            fail("sync");
+    }
+
+    void Mmap_Sink::unmap() noexcept
+    {
+        if (map)
+        {
+            ::munmap(map, size);
+            map = nullptr;
+        }
+    }
+
+    void Mmap_Sink::fail(const char* what)
+    {
+        std::string msg = "Unable to ";
+        msg += what;
+        msg += " file '";
+        msg += path.string();
+        msg += "': ";
+        msg += ::strerror(errno);
+        throw std::runtime_error(msg);
+    }
+
+    Write_Behind_Sink::Write_Behind_Sink(const std::filesystem::path& p) :
+        Write_Behind_Sink(p, Options())
+    {
+
+    }
+
+    Write_Behind_Sink::Write_Behind_Sink(const std::filesystem::path& p, const Options& opts) :
+        path(p),
+        options(opts)
+    {
+        options.block_size = std::max<size_t>(options.block_size, WRITE_BEHIND_ALIGNMENT);
+        options.block_size = (options.block_size + WRITE_BEHIND_ALIGNMENT - 1) / WRITE_BEHIND_ALIGNMENT * WRITE_BEHIND_ALIGNMENT;
+        options.blocks = std::max<size_t>(options.blocks, 2);
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            std::string msg = "Unable to open file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+
+        ring.resize(options.blocks);
+
+        for (auto& block : ring)
+        {
+            block.data = static_cast<char*>(std::aligned_alloc(WRITE_BEHIND_ALIGNMENT, options.block_size));
+
+            if (!block.data)
+            {
+                for (auto& b : ring)
+                    std::free(b.data);
+
+                ::close(fd);
+                throw std::bad_alloc();
+            }
+        }
+
+        writer = std::thread(&Write_Behind_Sink::run, this);
+    }
+
+    Write_Behind_Sink::~Write_Behind_Sink()
+    {
+        stop();
+
+        for (auto& block : ring)
+            std::free(block.data);
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void Write_Behind_Sink::reserve(size_t) noexcept
+    {
+
+    }
+
+    void Write_Behind_Sink::write(const char* data, size_t len)
+    {
+        while (len)
+        {
+            size_t n = len;
+            auto p = acquire(n);
+            std::memcpy(p, data, n);
+            commit(n);
+
+            data += n;
+            len -= n;
+        }
+    }
+
+    void Write_Behind_Sink::finish()
+    {
+        if (filled)
+            publish();
+
+        stop();
+        check();
+
+        if (options.sync_on_finish && ::fsync(fd) < 0)
+        {
+            std::string msg = "Unable to sync file '";
+            msg += path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+    }
+
+    char* Write_Behind_Sink::acquire(size_t& len) noexcept
+    {
+        auto p = produced.load(std::memory_order_relaxed);
+
+        /* backpressure: wait for the writer to give a block back */
+        while (true)
+        {
+            auto c = consumed.load(std::memory_order_acquire);
+
+            if (p - c < ring.size())
+                break;
+
+            consumed.wait(c, std::memory_order_acquire);
+        }
+
+        len = std::min(len, options.block_size - filled);
+        return ring[p % ring.size()].data + filled;
+    }
+
+    void Write_Behind_Sink::commit(size_t len)
+    {
+        check();
+
+        filled += len;
+
+        if (filled == options.block_size)
+            publish();
+    }
+
+    void Write_Behind_Sink::publish() noexcept
+    {
+        auto p = produced.load(std::memory_order_relaxed);
+        ring[p % ring.size()].len = filled;
+        filled = 0;
+
+        produced.store(p + 1, std::memory_order_release);
+        produced.notify_one();
+    }
+
+    void Write_Behind_Sink::stop() noexcept
+    {
+        if (!writer.joinable())
+            return;
+
+        /* empty block terminates the writer */
+        size_t len = 0;
+        acquire(len);
+        filled = 0;
+        publish();
+
+        writer.join();
+    }
+
+    void Write_Behind_Sink::run() noexcept
+    {
+        size_t c = 0;
+        size_t unsynced = 0;
+
+        while (true)
+        {
+            produced.wait(c, std::memory_order_acquire);
+
+            const auto& block = ring[c % ring.size()];
+
+            if (block.len == 0)
+                break;
+
+            /* after a failure blocks are only drained to keep the connection going */
+            for (size_t written = 0; written < block.len && !error; )
+            {
+                auto res = ::write(fd, block.data + written, block.len - written);
+
+                if (res < 0)
+                {
+                    if (errno != EINTR)
+                        error = errno;
+
+                    continue;
+                }
+
+                written += res;
+            }
+
+            unsynced += block.len;
+
+            if (options.sync_interval && unsynced >= options.sync_interval && !error)
+            {
+                if (::fdatasync(fd) < 0)
+                    error = errno;
+
+                unsynced = 0;
+            }
+
+            consumed.store(++c, std::memory_order_release);
+            consumed.notify_one();
+        }
+
+        consumed.store(++c, std::memory_order_release);
+        consumed.notify_one();
+    }
+
+    void Write_Behind_Sink::check() const
+    {
+        if (int err = error.load())
+        {
+            std::string msg = "Unable to write file '";
+            msg += path.string();
+            msg += "': ";
+            msg += ::strerror(err);
+            throw std::runtime_error(msg);
+        }
+    }
+
+    Direct_Io_Sink::Direct_Io_Sink(const std::filesystem::path& p) :
+        Direct_Io_Sink(p, Options())
+    {
+
+    }
+
+    Direct_Io_Sink::Direct_Io_Sink(const std::filesystem::path& p, const Options& opts) :
+        path(p),
+        options(opts)
+    {
+        options.block_size = std::max<size_t>(options.block_size, DIRECT_IO_ALIGNMENT);
+        options.block_size = (options.block_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        options.window = std::max(options.window, options.block_size);
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        direct = fd >= 0;
+
+        /* tmpfs and some network file systems refuse O_DIRECT */
+        if (fd < 0 && errno == EINVAL)
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0)
+        {
+            std::string msg = "Unable to open file '";
+            msg += path.string();
+            msg += "'.";
+            throw std::runtime_error(msg);
+        }
+
+        block = static_cast<char*>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, options.block_size));
+
+        if (!block)
+        {
+            ::close(fd);
+            throw std::bad_alloc();
+        }
+    }
+
+    Direct_Io_Sink::~Direct_Io_Sink()
+    {
+        std::free(block);
+
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void Direct_Io_Sink::reserve(size_t len) noexcept
+    {
+        /* contiguous extents, the size is fixed by the data actually written */
+        if (len)
+            ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len);
+    }
+
+    void Direct_Io_Sink::write(const char* data, size_t len)
+    {
+        while (len)
+        {
+            size_t n = len;
+            auto p = acquire(n);
+            std::memcpy(p, data, n);
+            commit(n);
+
+            data += n;
+            len -= n;
+        }
+    }
+
+    void Direct_Io_Sink::finish()
+    {
+        auto size = offset + static_cast<off_t>(filled);
+
+        if (filled)
+        {
+            /* O_DIRECT writes whole blocks only, the padding is cut off below */
+            auto padded = direct ? (filled + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT : filled;
+            std::memset(block + filled, 0, padded - filled);
+            flush(padded);
+        }
+
+        /* also frees blocks preallocated beyond shorter content */
+        if (::ftruncate(fd, size) < 0)
+            fail("size");
+
+        if (!direct)
+            writeback(true);
+
+        if (options.sync_on_finish && ::fsync(fd) < 0)
+            fail("sync");
+    }
+
+    char* Direct_Io_Sink::acquire(size_t& len) noexcept
+    {
+        len = std::min(len, options.block_size - filled);
+        return block + filled;
+    }
+
+    void Direct_Io_Sink::commit(size_t len)
+    {
+        filled += len;
+
+        if (filled == options.block_size)
+            flush(filled);
+    }
+
+    bool Direct_Io_Sink::is_direct() const noexcept
+    {
+        return direct;
+    }
+
+    void Direct_Io_Sink::flush(size_t len)
+    {
+        size_t written = 0;
+
+        while (written < len)
+        {
+            auto res = ::pwrite(fd, block + written, len - written, offset);
+
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                /* file system accepted the flag at open but not the write */
+                if (errno == EINVAL && direct)
+                {
+                    drop_direct();
+                    continue;
+                }
+
+                fail("write");
+            }
+
+            written += res;
+            offset += res;
+        }
+
+        filled = 0;
+
+        if (!direct && offset - window_start >= static_cast<off_t>(options.window))
+            writeback(false);
+    }
+
+    void Direct_Io_Sink::drop_direct()
+    {
+        auto flags = ::fcntl(fd, F_GETFL);
+
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0)
+            fail("write");
+
+        direct = false;
+    }
+
+    void Direct_Io_Sink::writeback(bool last)
+    {
+        /*
+         * Start writing the current window and wait for the previous one, so
+         * the disk stays busy while dirty pages never exceed two windows.
+        */
+        if (offset > window_start &&
+            ::sync_file_range(fd, window_start, offset - window_start, SYNC_FILE_RANGE_WRITE) < 0 &&
+            errno != EINVAL && errno != ENOSYS)
+            fail("sync");
+
+        auto from = previous_window >= 0 ? previous_window : window_start;
+        auto to = last ? offset : window_start;
+
+        if (to > from)
+        {
+            if (::sync_file_range(fd, from, to - from, SYNC_FILE_RANGE_WAIT_BEFORE |
+                                                       SYNC_FILE_RANGE_WRITE |
+                                                       SYNC_FILE_RANGE_WAIT_AFTER) < 0 &&
+                errno != EINVAL && errno != ENOSYS)
+                fail("sync");
+
+            ::posix_fadvise(fd, from, to - from, POSIX_FADV_DONTNEED);
+        }
+
+        previous_window = window_start;
+        window_start = offset;
+    }
+
+    void Direct_Io_Sink::fail(const char* what)
+    {
+        std::string msg = "Unable to ";
+        msg += what;
+        msg += " file '";
+        msg += path.string();
+        msg += "': ";
+        msg += ::strerror(errno);
+        throw std::runtime_error(msg);
+    }
+
+    void Memory_Sink::reserve(size_t len)
+    {
+        buffer.reserve(len);
+    }
+
+    void Memory_Sink::write(const char* data, size_t len)
+    {
+        buffer.insert(buffer.end(), data, data + len);
+    }
+
+    void Memory_Sink::finish() noexcept
+    {
+
+    }
+
+    const std::vector<char>& Memory_Sink::data() const noexcept
+    {
+        return buffer;
+    }
+
+    std::vector<char> Memory_Sink::release() noexcept
+    {
+        return std::move(buffer);
+    }
+
+    Pipe_Sink::Pipe_Sink(int f) :
+        fd(f)
+    {
+        struct stat st;
+
+        if (::fstat(fd, &st) < 0 || !S_ISFIFO(st.st_mode))
+            return;
+
+        auto pipe_size = ::fcntl(fd, F_GETPIPE_SZ);
+        half_size = pipe_size > 0 ? pipe_size : PIPE_SINK_DEFAULT_SIZE;
+
+        auto page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        half_size = (half_size + page_size - 1) / page_size * page_size;
+
+        buffer = static_cast<char*>(std::aligned_alloc(page_size, 2 * half_size));
+        use_splice = buffer != nullptr;
+    }
+
+    Pipe_Sink::~Pipe_Sink()
+    {
+        std::free(buffer);
+    }
+
+    void Pipe_Sink::reserve(size_t) noexcept
+    {
+
+    }
+
+    void Pipe_Sink::write(const char* data, size_t len)
+    {
+        if (!use_splice)
+        {
+            write_all(data, len);
+            return;
+        }
+
+        while (len)
+        {
+            auto n = std::min(len, half_size - filled);
+            std::memcpy(buffer + half * half_size + filled, data, n);
+            filled += n;
+            data += n;
+            len -= n;
+
+            if (filled == half_size)
+                flush();
+        }
+    }
+
+    void Pipe_Sink::finish()
+    {
+        if (use_splice)
+            flush();
+    }
+
+    void Pipe_Sink::flush()
+    {
+        if (filled)
+        {
+            splice_all(buffer + half * half_size, filled);
+            half ^= 1;
+            filled = 0;
+        }
+    }
+
+    void Pipe_Sink::write_all(const char* data, size_t len)
+    {
+        while (len)
+        {
+            auto n = ::write(fd, data, len);
+
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                std::string msg = "Unable to write output: ";
+                msg += ::strerror(errno);
+                throw std::runtime_error(msg);
+            }
+
+            data += n;
+            len -= n;
+        }
+    }
+
+    void Pipe_Sink::splice_all(char* data, size_t len)
+    {
+        while (len)
+        {
+            iovec iov { data, len };
+            auto n = ::vmsplice(fd, &iov, 1, 0);
+
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno == EINVAL || errno == ENOSYS)
+                {
+                    /* vmsplice is not usable, fall back to plain writes */
+                    use_splice = false;
+                    write_all(data, len);
+                    return;
+                }
+
+                std::string msg = "Unable to write output: ";
+                msg += ::strerror(errno);
+                throw std::runtime_error(msg);
+            }
+
+            data += n;
+            len -= n;
+        }
+    }
+
+    Callback_Sink::Callback_Sink(callback_t cb) noexcept :
+        callback(std::move(cb))
+    {
+
+    }
+
+    void Callback_Sink::reserve(size_t) noexcept
+    {
+
+    }
+
+    void Callback_Sink::write(const char* data, size_t len)
+    {
+        callback(data, len);
+    }
+
+    void Callback_Sink::finish() noexcept
+    {
+
+    }
+
+    isink_ptr_t create_file_sink(const std::filesystem::path& path, Output_Mode mode)
+    {
+        switch (mode)
+        {
+            case Output_Mode::mmap:
+                return std::make_unique<Mmap_Sink>(path);
+
+            case Output_Mode::write_behind:
+                return std::make_unique<Write_Behind_Sink>(path);
+
+            case Output_Mode::direct:
+                return std::make_unique<Direct_Io_Sink>(path);
+
+            case Output_Mode::stream:
+            default:
+                return std::make_unique<File_Sink>(path);
+        }
+    }
+}
@@ -0,0 +1,244 @@
+#ifndef SINKS_H
+#define SINKS_H
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "isink.h"
+
+namespace http
+{
+    class File_Sink : public ISink
+    {
+    public:
+        explicit File_Sink(const std::filesystem::path& path, bool append = false);
+
+        void reserve(size_t) noexcept override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+
+    private:
+        std::filesystem::path path;
+        std::ofstream of;
+    };
+
+    /*
+     * Sizes the file by Content-Length, maps it with MAP_SHARED and lets
+     * the connection receive directly into the mapping. Without a known
+     * length it falls back to plain writes.
+    */
+    class Mmap_Sink : public IDirect_Sink
+    {
+    public:
+        struct Options
+        {
+            int advice = MADV_SEQUENTIAL;
+            size_t sync_interval = 0;       /* bytes between msync(MS_ASYNC), 0 - none */
+            bool sync_on_finish = false;    /* msync(MS_SYNC) before unmapping */
+        };
+
+    public:
+        explicit Mmap_Sink(const std::filesystem::path& path);
+        Mmap_Sink(const std::filesystem::path& path, const Options& opts);
+        ~Mmap_Sink();
+
+        void reserve(size_t len) override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+        char* acquire(size_t& len) noexcept override;
+        void commit(size_t len) override;
+
+    private:
+        void sync(size_t from, size_t to, int flags);
+        void unmap() noexcept;
+        [[noreturn]] void fail(const char* what);
+
+    private:
+        std::filesystem::path path;
+        Options options;
+        int fd = -1;
+        char* map = nullptr;
+        size_t size = 0;
+        size_t offset = 0;
+        size_t synced = 0;
+    };
+
+    /*
+     * Decouples the network from disk latency. The connection receives into
+     * a ring of pooled blocks, full blocks are handed over to a writer
+     * thread, which writes them and gives them back. If all blocks are in
+     * flight the connection waits, so the memory used is bounded.
+    */
+    class Write_Behind_Sink : public IDirect_Sink
+    {
+    public:
+        struct Options
+        {
+            size_t block_size = 256 * 1024;
+            size_t blocks = 16;             /* in flight, the backpressure limit */
+            size_t sync_interval = 0;       /* bytes between fdatasync, 0 - none */
+            bool sync_on_finish = false;    /* fsync before close */
+        };
+
+    public:
+        explicit Write_Behind_Sink(const std::filesystem::path& path);
+        Write_Behind_Sink(const std::filesystem::path& path, const Options& opts);
+        ~Write_Behind_Sink();
+
+        void reserve(size_t) noexcept override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+        char* acquire(size_t& len) noexcept override;
+        void commit(size_t len) override;
+
+    private:
+        struct Block
+        {
+            char* data = nullptr;
+            size_t len = 0;
+        };
+
+        void publish() noexcept;
+        void stop() noexcept;
+        void run() noexcept;
+        void check() const;
+
+    private:
+        std::filesystem::path path;
+        Options options;
+        int fd = -1;
+        std::vector<Block> ring;
+        size_t filled = 0;
+
+        /* single producer (connection), single consumer (writer) */
+        std::atomic<size_t> produced = 0;
+        std::atomic<size_t> consumed = 0;
+        std::atomic<int> error = 0;
+        std::thread writer;
+    };
+
+    /*
+     * Bypasses the page cache: the connection receives into an aligned block
+     * which is written with O_DIRECT, the unaligned tail is padded and the
+     * file truncated afterwards. Where O_DIRECT is not supported it writes
+     * through the cache, flushing each window with sync_file_range and
+     * dropping it with POSIX_FADV_DONTNEED.
+    */
+    class Direct_Io_Sink : public IDirect_Sink
+    {
+    public:
+        struct Options
+        {
+            size_t block_size = 1024 * 1024;
+            size_t window = 8 * 1024 * 1024;    /* bytes per writeback window without O_DIRECT */
+            bool sync_on_finish = false;        /* fsync before close */
+        };
+
+    public:
+        explicit Direct_Io_Sink(const std::filesystem::path& path);
+        Direct_Io_Sink(const std::filesystem::path& path, const Options& opts);
+        ~Direct_Io_Sink();
+
+        void reserve(size_t len) noexcept override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+        char* acquire(size_t& len) noexcept override;
+        void commit(size_t len) override;
+
+        bool is_direct() const noexcept;
+
+    private:
+        void flush(size_t len);
+        void drop_direct();
+        void writeback(bool last);
+        [[noreturn]] void fail(const char* what);
+
+    private:
+        std::filesystem::path path;
+        Options options;
+        int fd = -1;
+        bool direct = false;
+        char* block = nullptr;
+        size_t filled = 0;
+        off_t offset = 0;
+        off_t window_start = 0;
+        off_t previous_window = -1;
+    };
+
+    class Memory_Sink : public ISink
+    {
+    public:
+        void reserve(size_t len) override;
+        void write(const char* data, size_t len) override;
+        void finish() noexcept override;
+
+        const std::vector<char>& data() const noexcept;
+        std::vector<char> release() noexcept;
+
+    private:
+        std::vector<char> buffer;
+    };
+
+    /*
+     * Writes to a file descriptor. If it is a pipe, data are accumulated
+     * in two halves of pipe capacity size each and passed by vmsplice:
+     * once one half is completely spliced the other one can be reused,
+     * because the pipe is unable to hold more than its capacity.
+    */
+    class Pipe_Sink : public ISink
+    {
+    public:
+        explicit Pipe_Sink(int fd);
+        ~Pipe_Sink();
+
+        void reserve(size_t) noexcept override;
+        void write(const char* data, size_t len) override;
+        void finish() override;
+
+    private:
+        void flush();
+        void write_all(const char* data, size_t len);
+        void splice_all(char* data, size_t len);
+
+    private:
+        int fd;
+        bool use_splice = false;
+        char* buffer = nullptr;
+        size_t half_size = 0;
+        size_t half = 0;
+        size_t filled = 0;
+    };
+
+    class Callback_Sink : public ISink
+    {
+    public:
+        using callback_t = std::function<void(const char*, size_t)>;
+
+        explicit Callback_Sink(callback_t cb) noexcept;
+
+        void reserve(size_t) noexcept override;
+        void write(const char* data, size_t len) override;
+        void finish() noexcept override;
+
+    private:
+        callback_t callback;
+    };
+
+    enum class Output_Mode
+    {
+        stream,
+        mmap,
+        write_behind,
+        direct
+    };
+
+    isink_ptr_t create_file_sink(const std::filesystem::path& path, Output_Mode mode);
+}
+
+#endif // SINKS_H
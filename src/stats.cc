@@ -0,0 +1,441 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "stats.h"
+
+#define STATS_RATE_WINDOW_MS    1000
+#define STATS_READ_ATTEMPTS     100
+
+namespace http
+{
+    namespace
+    {
+        struct Slot_Snapshot
+        {
+            Transfer_Phase phase;
+            std::uint32_t retries;
+            std::uint64_t bytes;
+            std::uint64_t total;
+            std::uint64_t rate;
+            std::uint64_t started;
+            char url[STATS_URL_SIZE];
+        };
+
+        /* consistent copy of the slot or false if it is free or kept busy */
+        bool snapshot(const Stats_Slot& slot, Slot_Snapshot& copy) noexcept
+        {
+            for (unsigned attempt = 0; attempt < STATS_READ_ATTEMPTS; ++attempt)
+            {
+                auto before = slot.sequence.load(std::memory_order_acquire);
+
+                if (before & 1)
+                    continue;
+
+                if (!slot.in_use.load(std::memory_order_relaxed))
+                    return false;
+
+                copy.phase = static_cast<Transfer_Phase>(slot.phase.load(std::memory_order_relaxed));
+                copy.retries = slot.retries.load(std::memory_order_relaxed);
+                copy.bytes = slot.bytes.load(std::memory_order_relaxed);
+                copy.total = slot.total.load(std::memory_order_relaxed);
+                copy.rate = slot.rate.load(std::memory_order_relaxed);
+                copy.started = slot.started.load(std::memory_order_relaxed);
+                std::memcpy(copy.url, slot.url, sizeof(copy.url));
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (slot.sequence.load(std::memory_order_relaxed) == before)
+                {
+                    copy.url[sizeof(copy.url) - 1] = '\0';
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        const char* phase_name(Transfer_Phase phase) noexcept
+        {
+            switch (phase)
+            {
+                case Transfer_Phase::connecting:    return "connecting";
+                case Transfer_Phase::receiving:     return "receiving";
+                case Transfer_Phase::waiting:       return "waiting";
+                case Transfer_Phase::finished:      return "finished";
+                case Transfer_Phase::failed:        return "failed";
+                case Transfer_Phase::idle:
+                default:                            return "idle";
+            }
+        }
+
+        std::string escape_label(const char* value)
+        {
+            std::string result;
+
+            for (; *value; ++value)
+            {
+                if (*value == '\\' || *value == '"')
+                    result += '\\';
+
+                if (*value == '\n')
+                    result += "\\n";
+                else
+                    result += *value;
+            }
+
+            return result;
+        }
+
+        std::uint64_t unix_time_ms() noexcept
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    void Stats::open(const std::filesystem::path& path)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0 || ::ftruncate(fd, sizeof(Stats_Segment)) < 0)
+        {
+            std::string msg = "Unable to create stats file '";
+            msg += path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+
+            if (fd >= 0)
+                ::close(fd);
+
+            throw std::runtime_error(msg);
+        }
+
+        auto addr = ::mmap(nullptr, sizeof(Stats_Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (addr == MAP_FAILED)
+        {
+            std::string msg = "Unable to map stats file: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        /* the file is zeroed, which is a valid initial state of every counter */
+        auto s = new (addr) Stats_Segment();
+        s->version = STATS_VERSION;
+        s->slot_count = STATS_SLOTS;
+        s->pid = ::getpid();
+        s->magic.store(STATS_MAGIC, std::memory_order_release);
+
+        /* never unmapped: connections may still count while the process exits */
+        segment.store(s, std::memory_order_release);
+    }
+
+    Stats_Slot* Stats::acquire(const std::string& url) noexcept
+    {
+        auto s = segment.load(std::memory_order_acquire);
+
+        if (!s)
+            return nullptr;
+
+        s->transfers.fetch_add(1, std::memory_order_relaxed);
+
+        for (auto& slot : s->slots)
+        {
+            std::uint32_t free = 0;
+
+            if (slot.in_use.load(std::memory_order_relaxed) == 0 &&
+                slot.in_use.compare_exchange_strong(free, 1, std::memory_order_acquire))
+            {
+                auto sequence = slot.sequence.load(std::memory_order_relaxed);
+                slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                slot.phase.store(static_cast<std::uint32_t>(Transfer_Phase::idle), std::memory_order_relaxed);
+                slot.retries.store(0, std::memory_order_relaxed);
+                slot.bytes.store(0, std::memory_order_relaxed);
+                slot.total.store(0, std::memory_order_relaxed);
+                slot.rate.store(0, std::memory_order_relaxed);
+                slot.started.store(unix_time_ms(), std::memory_order_relaxed);
+
+                auto len = std::min(url.size(), sizeof(slot.url) - 1);
+                std::memcpy(slot.url, url.data(), len);
+                slot.url[len] = '\0';
+
+                slot.sequence.store(sequence + 2, std::memory_order_release);
+                return &slot;
+            }
+        }
+
+        /* more transfers than slots, only the aggregate counters see it */
+        return nullptr;
+    }
+
+    void Stats::release(Stats_Slot* slot, bool succeeded) noexcept
+    {
+        auto s = segment.load(std::memory_order_acquire);
+
+        if (!s)
+            return;
+
+        (succeeded ? s->succeeded : s->failed).fetch_add(1, std::memory_order_relaxed);
+
+        if (slot)
+            slot->in_use.store(0, std::memory_order_release);
+    }
+
+    void Stats::add_bytes(size_t len) noexcept
+    {
+        if (auto s = segment.load(std::memory_order_relaxed))
+            s->bytes.fetch_add(len, std::memory_order_relaxed);
+    }
+
+    void Stats::socket_opened() noexcept
+    {
+        if (auto s = segment.load(std::memory_order_relaxed))
+            s->open_sockets.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Stats::socket_closed() noexcept
+    {
+        if (auto s = segment.load(std::memory_order_relaxed))
+            s->open_sockets.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void Stats::retried() noexcept
+    {
+        if (auto s = segment.load(std::memory_order_relaxed))
+            s->retries.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Stats::tls_established(bool resumed, bool kernel) noexcept
+    {
+        if (auto s = segment.load(std::memory_order_relaxed))
+        {
+            s->tls_sessions.fetch_add(1, std::memory_order_relaxed);
+
+            if (resumed)
+                s->tls_resumed.fetch_add(1, std::memory_order_relaxed);
+
+            if (kernel)
+                s->tls_kernel.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    Stats& Stats::shared()
+    {
+        static Stats stats;
+        return stats;
+    }
+
+    void Stats::export_prometheus(const std::filesystem::path& path, std::ostream& out)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if (fd < 0 || ::fstat(fd, &st) < 0)
+        {
+            std::string msg = "Unable to open stats file '";
+            msg += path.string();
+            msg += "': ";
+            msg += ::strerror(errno);
+
+            if (fd >= 0)
+                ::close(fd);
+
+            throw std::runtime_error(msg);
+        }
+
+        if (static_cast<size_t>(st.st_size) < sizeof(Stats_Segment))
+        {
+            ::close(fd);
+            throw std::runtime_error("Unsupported stats file format.");
+        }
+
+        auto addr = ::mmap(nullptr, sizeof(Stats_Segment), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (addr == MAP_FAILED)
+        {
+            std::string msg = "Unable to map stats file: ";
+            msg += ::strerror(errno);
+            throw std::runtime_error(msg);
+        }
+
+        const auto& s = *static_cast<const Stats_Segment*>(addr);
+
+        if (s.magic.load(std::memory_order_acquire) != STATS_MAGIC ||
+            s.version != STATS_VERSION ||
+            s.slot_count != STATS_SLOTS)
+        {
+            ::munmap(addr, sizeof(Stats_Segment));
+            throw std::runtime_error("Unsupported stats file format.");
+        }
+
+        auto pid = std::to_string(s.pid);
+
+        auto metric = [&](const char* name, const char* type, const char* help, auto value)
+        {
+            out << "# HELP " << name << ' ' << help << '\n'
+                << "# TYPE " << name << ' ' << type << '\n'
+                << name << "{pid=\"" << pid << "\"} " << value << '\n';
+        };
+
+        std::vector<Slot_Snapshot> transfers;
+        std::uint64_t rate = 0;
+
+        for (const auto& slot : s.slots)
+        {
+            Slot_Snapshot copy;
+
+            if (snapshot(slot, copy))
+            {
+                rate += copy.rate;
+                transfers.push_back(copy);
+            }
+        }
+
+        metric("downloader_received_bytes_total", "counter", "Bytes received by all transfers.", s.bytes.load());
+        metric("downloader_transfers_total", "counter", "Transfers started.", s.transfers.load());
+        metric("downloader_transfers_succeeded_total", "counter", "Transfers completed.", s.succeeded.load());
+        metric("downloader_transfers_failed_total", "counter", "Transfers failed.", s.failed.load());
+        metric("downloader_retries_total", "counter", "Attempts repeated after a failure.", s.retries.load());
+        metric("downloader_open_sockets", "gauge", "Sockets in use by transfers.", s.open_sockets.load());
+        metric("downloader_tls_sessions_total", "counter", "TLS handshakes completed.", s.tls_sessions.load());
+        metric("downloader_tls_resumed_total", "counter", "TLS sessions resumed from a ticket.", s.tls_resumed.load());
+        metric("downloader_tls_kernel_offload_total", "counter", "TLS sessions with records handled by the kernel.", s.tls_kernel.load());
+        metric("downloader_active_transfers", "gauge", "Transfers in progress.", transfers.size());
+        metric("downloader_rate_bytes_per_second", "gauge", "Receive rate of all transfers.", rate);
+
+        auto per_transfer = [&](const char* name, const char* type, const char* help, auto field)
+        {
+            out << "# HELP " << name << ' ' << help << '\n'
+                << "# TYPE " << name << ' ' << type << '\n';
+
+            for (const auto& t : transfers)
+            {
+                out << name << "{pid=\"" << pid
+                    << "\",url=\"" << escape_label(t.url)
+                    << "\",phase=\"" << phase_name(t.phase)
+                    << "\"} " << field(t) << '\n';
+            }
+        };
+
+        per_transfer("downloader_transfer_received_bytes", "gauge", "Bytes received by the transfer.",
+                     [](const Slot_Snapshot& t) { return t.bytes; });
+        per_transfer("downloader_transfer_size_bytes", "gauge", "Size of the content, 0 if unknown.",
+                     [](const Slot_Snapshot& t) { return t.total; });
+        per_transfer("downloader_transfer_rate_bytes_per_second", "gauge", "Receive rate of the transfer.",
+                     [](const Slot_Snapshot& t) { return t.rate; });
+        per_transfer("downloader_transfer_retries", "gauge", "Attempts repeated by the transfer.",
+                     [](const Slot_Snapshot& t) { return t.retries; });
+        per_transfer("downloader_transfer_start_time_seconds", "gauge", "Start of the transfer, unix time.",
+                     [](const Slot_Snapshot& t) { return t.started / 1000; });
+
+        ::munmap(addr, sizeof(Stats_Segment));
+    }
+
+    Transfer_Stats::Transfer_Stats(const std::string& url) noexcept :
+        slot(Stats::shared().acquire(url))
+    {
+        if (slot)
+            sequence = slot->sequence.load(std::memory_order_relaxed);
+    }
+
+    Transfer_Stats::~Transfer_Stats()
+    {
+        /* left by an exception */
+        finish(false);
+    }
+
+    void Transfer_Stats::set_phase(Transfer_Phase phase) noexcept
+    {
+        if (!slot)
+            return;
+
+        begin();
+        slot->phase.store(static_cast<std::uint32_t>(phase), std::memory_order_relaxed);
+
+        if (phase != Transfer_Phase::receiving)
+            slot->rate.store(0, std::memory_order_relaxed);
+
+        end();
+    }
+
+    void Transfer_Stats::set_total(size_t total) noexcept
+    {
+        if (!slot)
+            return;
+
+        begin();
+        slot->total.store(total, std::memory_order_relaxed);
+        end();
+    }
+
+    void Transfer_Stats::add(size_t len) noexcept
+    {
+        if (!slot)
+            return;
+
+        window_bytes += len;
+
+        auto now = clock_t::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start).count();
+
+        begin();
+        slot->bytes.store(slot->bytes.load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+
+        if (elapsed >= STATS_RATE_WINDOW_MS)
+        {
+            slot->rate.store(window_bytes * 1000 / elapsed, std::memory_order_relaxed);
+            window_start = now;
+            window_bytes = 0;
+        }
+
+        end();
+    }
+
+    void Transfer_Stats::retry() noexcept
+    {
+        Stats::shared().retried();
+
+        if (!slot)
+            return;
+
+        begin();
+        slot->retries.store(slot->retries.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        end();
+    }
+
+    void Transfer_Stats::finish(bool succeeded) noexcept
+    {
+        if (finished)
+            return;
+
+        finished = true;
+        set_phase(succeeded ? Transfer_Phase::finished : Transfer_Phase::failed);
+        Stats::shared().release(slot, succeeded);
+        slot = nullptr;
+    }
+
+    void Transfer_Stats::begin() noexcept
+    {
+        /* odd: readers retry */
+        slot->sequence.store(++sequence, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void Transfer_Stats::end() noexcept
+    {
+        slot->sequence.store(++sequence, std::memory_order_release);
+    }
+}
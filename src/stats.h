@@ -0,0 +1,128 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+/*
+ * Live counters for external monitors.
+ *
+ * The counters are kept in a memory mapped file (e.g. in /dev/shm), so
+ * another process can read them at any moment without disturbing the
+ * downloader. Aggregate counters are independent atomics; every transfer
+ * owns a slot whose fields are published together under a seqlock: the
+ * sequence is odd while the owner writes, a reader retries until it sees
+ * the same even sequence before and after copying the slot.
+*/
+
+#define STATS_MAGIC         0x53544c44u     /* "DLTS" */
+#define STATS_VERSION       2
+#define STATS_SLOTS         64
+#define STATS_URL_SIZE      200
+
+namespace http
+{
+    enum class Transfer_Phase : std::uint32_t
+    {
+        idle,
+        connecting,
+        receiving,
+        waiting,        /* before the next attempt */
+        finished,
+        failed
+    };
+
+    struct alignas(64) Stats_Slot
+    {
+        std::atomic<std::uint32_t> sequence;
+        std::atomic<std::uint32_t> in_use;
+        std::atomic<std::uint32_t> phase;
+        std::atomic<std::uint32_t> retries;
+        std::atomic<std::uint64_t> bytes;
+        std::atomic<std::uint64_t> total;       /* 0 - unknown */
+        std::atomic<std::uint64_t> rate;        /* bytes per second */
+        std::atomic<std::uint64_t> started;     /* unix time, ms */
+        char url[STATS_URL_SIZE];
+    };
+
+    /* layout of the file, a new version for any change */
+    struct Stats_Segment
+    {
+        std::atomic<std::uint32_t> magic;       /* written last */
+        std::uint32_t version;
+        std::uint32_t slot_count;
+        std::uint32_t pid;
+        std::atomic<std::uint64_t> bytes;
+        std::atomic<std::uint64_t> transfers;
+        std::atomic<std::uint64_t> succeeded;
+        std::atomic<std::uint64_t> failed;
+        std::atomic<std::uint64_t> retries;
+        std::atomic<std::int64_t> open_sockets;
+        std::atomic<std::uint64_t> tls_sessions;
+        std::atomic<std::uint64_t> tls_resumed;
+        std::atomic<std::uint64_t> tls_kernel;      /* records handled by kernel TLS */
+        Stats_Slot slots[STATS_SLOTS];
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared counters must be lock free");
+
+    class Stats
+    {
+    public:
+        /* starts publishing into the file, once per process */
+        void open(const std::filesystem::path& path);
+
+        Stats_Slot* acquire(const std::string& url) noexcept;
+        void release(Stats_Slot* slot, bool succeeded) noexcept;
+
+        void add_bytes(size_t len) noexcept;
+        void socket_opened() noexcept;
+        void socket_closed() noexcept;
+        void retried() noexcept;
+        void tls_established(bool resumed, bool kernel) noexcept;
+
+        static Stats& shared();
+
+        /* prints counters published in the file in Prometheus text format */
+        static void export_prometheus(const std::filesystem::path& path, std::ostream& out);
+
+    private:
+        std::atomic<Stats_Segment*> segment = nullptr;
+    };
+
+    /* slot of one transfer, written only by the thread doing the transfer */
+    class Transfer_Stats
+    {
+    public:
+        explicit Transfer_Stats(const std::string& url) noexcept;
+        ~Transfer_Stats();
+
+        Transfer_Stats(const Transfer_Stats&) = delete;
+        Transfer_Stats& operator=(const Transfer_Stats&) = delete;
+
+        void set_phase(Transfer_Phase phase) noexcept;
+        void set_total(size_t total) noexcept;
+        void add(size_t len) noexcept;
+        void retry() noexcept;
+        void finish(bool succeeded) noexcept;
+
+    private:
+        void begin() noexcept;
+        void end() noexcept;
+
+    private:
+        using clock_t = std::chrono::steady_clock;
+
+        Stats_Slot* slot;
+        std::uint32_t sequence = 0;
+        bool finished = false;
+        clock_t::time_point window_start = clock_t::now();
+        size_t window_bytes = 0;
+    };
+}
+
+#endif // STATS_H
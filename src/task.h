@@ -0,0 +1,180 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+/*
+ * Lazily started coroutine which resumes its awaiter on completion.
+*/
+
+namespace http
+{
+    template<typename T>
+    class Task;
+
+    namespace detail
+    {
+        struct Task_Promise_Base
+        {
+            struct Final_Awaiter
+            {
+                bool await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                template<typename P>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+                {
+                    auto continuation = h.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+
+                void await_resume() noexcept
+                {
+
+                }
+            };
+
+            std::suspend_always initial_suspend() noexcept
+            {
+                return {};
+            }
+
+            Final_Awaiter final_suspend() noexcept
+            {
+                return {};
+            }
+
+            void unhandled_exception() noexcept
+            {
+                error = std::current_exception();
+            }
+
+            void rethrow_if_failed()
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+        };
+
+        template<typename T>
+        struct Task_Promise : Task_Promise_Base
+        {
+            Task<T> get_return_object() noexcept;
+
+            template<typename U>
+            void return_value(U&& v)
+            {
+                value.emplace(std::forward<U>(v));
+            }
+
+            T result()
+            {
+                rethrow_if_failed();
+                return std::move(*value);
+            }
+
+            std::optional<T> value;
+        };
+
+        template<>
+        struct Task_Promise<void> : Task_Promise_Base
+        {
+            Task<void> get_return_object() noexcept;
+
+            void return_void() noexcept
+            {
+
+            }
+
+            void result()
+            {
+                rethrow_if_failed();
+            }
+        };
+    }
+
+    template<typename T = void>
+    class [[nodiscard]] Task
+    {
+    public:
+        using promise_type = detail::Task_Promise<T>;
+        using handle_t = std::coroutine_handle<promise_type>;
+
+        explicit Task(handle_t h) noexcept :
+            handle(h)
+        {
+
+        }
+
+        Task(Task&& other) noexcept :
+            handle(std::exchange(other.handle, nullptr))
+        {
+
+        }
+
+        Task& operator=(Task&& other) noexcept
+        {
+            if (this != &other)
+            {
+                if (handle)
+                    handle.destroy();
+
+                handle = std::exchange(other.handle, nullptr);
+            }
+
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task()
+        {
+            if (handle)
+                handle.destroy();
+        }
+
+        bool await_ready() const noexcept
+        {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+        {
+            handle.promise().continuation = awaiter;
+            return handle;
+        }
+
+        T await_resume()
+        {
+            return handle.promise().result();
+        }
+
+    private:
+        handle_t handle;
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        Task<T> Task_Promise<T>::get_return_object() noexcept
+        {
+            return Task<T>(std::coroutine_handle<Task_Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Task_Promise<void>::get_return_object() noexcept
+        {
+            return Task<void>(std::coroutine_handle<Task_Promise<void>>::from_promise(*this));
+        }
+    }
+}
+
+#endif // TASK_H
@@ -0,0 +1,247 @@
+#include <arpa/inet.h>
+
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "protocol.h"
+#include "tls.h"
+
+namespace http
+{
+    namespace
+    {
+        std::string last_error()
+        {
+            char buff[256];
+            auto code = ::ERR_get_error();
+
+            if (code == 0)
+                return "unknown error";
+
+            ::ERR_error_string_n(code, buff, sizeof(buff));
+            ::ERR_clear_error();
+            return buff;
+        }
+
+        bool is_ip_literal(const std::string& host) noexcept
+        {
+            unsigned char addr[sizeof(in6_addr)];
+            return ::inet_pton(AF_INET, host.c_str(), addr) == 1 || ::inet_pton(AF_INET6, host.c_str(), addr) == 1;
+        }
+    }
+
+    Tls_Context::Tls_Context()
+    {
+        ctx = ::SSL_CTX_new(::TLS_client_method());
+
+        if (!ctx)
+        {
+            std::string msg = "Unable to create TLS context: ";
+            msg += last_error();
+            throw std::runtime_error(msg);
+        }
+
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        ::SSL_CTX_set_default_verify_paths(ctx);
+        ::SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+#ifdef SSL_OP_ENABLE_KTLS
+        ::SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+        /* TLS 1.3 tickets arrive after the handshake, so they are caught by callback */
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        ::SSL_CTX_sess_set_new_cb(ctx, &Tls_Context::on_new_session);
+    }
+
+    Tls_Context::~Tls_Context()
+    {
+        for (auto& [key, session] : sessions)
+            ::SSL_SESSION_free(session);
+
+        ::SSL_CTX_free(ctx);
+    }
+
+    void Tls_Context::set_ca_file(const std::filesystem::path& path)
+    {
+        if (::SSL_CTX_load_verify_locations(ctx, path.c_str(), nullptr) != 1)
+        {
+            std::string msg = "Unable to load CA certificates from '";
+            msg += path.string();
+            msg += "': ";
+            msg += last_error();
+            throw std::runtime_error(msg);
+        }
+    }
+
+    void Tls_Context::set_verify(bool verify) noexcept
+    {
+        ::SSL_CTX_set_verify(ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, nullptr);
+    }
+
+    Tls_Context& Tls_Context::shared()
+    {
+        static Tls_Context context;
+        return context;
+    }
+
+    SSL* Tls_Context::create(const std::string& key)
+    {
+        auto ssl = ::SSL_new(ctx);
+
+        if (!ssl)
+        {
+            std::string msg = "Unable to create TLS session: ";
+            msg += last_error();
+            throw std::runtime_error(msg);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = sessions.find(key);
+
+        if (it != sessions.end())
+            ::SSL_set_session(ssl, it->second);
+
+        return ssl;
+    }
+
+    void Tls_Context::store(const std::string& key, SSL_SESSION* session) noexcept
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto& slot = sessions[key];
+
+        if (slot)
+            ::SSL_SESSION_free(slot);
+
+        slot = session;
+    }
+
+    int Tls_Context::on_new_session(SSL* ssl, SSL_SESSION* session)
+    {
+        auto owner = static_cast<Tls_Session*>(SSL_get_app_data(ssl));
+
+        if (!owner || !::SSL_SESSION_is_resumable(session))
+            return 0;
+
+        owner->context.store(owner->key, session);
+
+        /* the reference is kept */
+        return 1;
+    }
+
+    Tls_Session::Tls_Session(Tls_Context& ctx, int sock, const std::string& host, std::uint16_t port) :
+        context(ctx),
+        key(host + ':' + std::to_string(port))
+    {
+        ssl = context.create(key);
+
+        SSL_set_app_data(ssl, this);
+        ::SSL_set_fd(ssl, sock);
+
+        /* an address is matched against iPAddress names and is not sent as SNI (RFC 6066, 3) */
+        if (is_ip_literal(host))
+        {
+            ::X509_VERIFY_PARAM_set1_ip_asc(::SSL_get0_param(ssl), host.c_str());
+        }
+        else
+        {
+            SSL_set_tlsext_host_name(ssl, host.c_str());
+            ::SSL_set1_host(ssl, host.c_str());
+        }
+
+        auto res = ::SSL_connect(ssl);
+
+        if (res != 1)
+        {
+            auto verify = ::SSL_get_verify_result(ssl);
+            auto error = ::SSL_get_error(ssl, res);
+            auto reason = last_error();
+
+            std::string msg = "Unable to establish TLS session with ";
+            msg += host;
+            msg += ": ";
+
+            /* certificate problems are not fixed by retrying */
+            if (verify != X509_V_OK)
+            {
+                msg += ::X509_verify_cert_error_string(verify);
+                ::SSL_free(ssl);
+                throw std::runtime_error(msg);
+            }
+
+            msg += error == SSL_ERROR_SYSCALL && errno ? ::strerror(errno) : reason;
+            ::SSL_free(ssl);
+            throw Transfer_Error(msg);
+        }
+    }
+
+    Tls_Session::~Tls_Session()
+    {
+        /* without shutdown the session is considered broken and is not resumed */
+        ::SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        ::SSL_free(ssl);
+    }
+
+    ssize_t Tls_Session::read(char* buff, size_t len) noexcept
+    {
+        errno = 0;
+        return result(::SSL_read(ssl, buff, len));
+    }
+
+    ssize_t Tls_Session::write(const char* buff, size_t len) noexcept
+    {
+        errno = 0;
+        return result(::SSL_write(ssl, buff, len));
+    }
+
+    bool Tls_Session::resumed() const noexcept
+    {
+        return ::SSL_session_reused(ssl);
+    }
+
+    bool Tls_Session::kernel_offload() const noexcept
+    {
+#ifndef OPENSSL_NO_KTLS
+        return BIO_get_ktls_recv(::SSL_get_rbio(ssl)) || BIO_get_ktls_send(::SSL_get_wbio(ssl));
+#else
+        return false;
+#endif
+    }
+
+    ssize_t Tls_Session::result(int res) noexcept
+    {
+        if (res > 0)
+            return res;
+
+        auto error = ::SSL_get_error(ssl, res);
+        ::ERR_clear_error();
+
+        switch (error)
+        {
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;
+
+            case SSL_ERROR_SYSCALL:
+                /* peer closed without close_notify */
+                if (errno == 0)
+                    return 0;
+
+                return -1;
+
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+
+            default:
+                errno = EPROTO;
+                return -1;
+        }
+    }
+}
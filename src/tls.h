@@ -0,0 +1,80 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <openssl/ssl.h>
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * RFC 8446 - "The Transport Layer Security (TLS) Protocol Version 1.3"
+ * https://www.ietf.org/rfc/rfc8446.html
+*/
+
+namespace http
+{
+    /*
+     * Client TLS configuration shared by connections. Keeps the last
+     * session of every host:port, so later connections to the same server
+     * resume it instead of doing a full handshake. Records are handled by
+     * kernel TLS where OpenSSL and the kernel support it.
+    */
+    class Tls_Context
+    {
+    public:
+        Tls_Context();
+        ~Tls_Context();
+
+        Tls_Context(const Tls_Context&) = delete;
+        Tls_Context& operator=(const Tls_Context&) = delete;
+
+        void set_ca_file(const std::filesystem::path& path);
+        void set_verify(bool verify) noexcept;
+
+        static Tls_Context& shared();
+
+    private:
+        friend class Tls_Session;
+
+        SSL* create(const std::string& key);
+        void store(const std::string& key, SSL_SESSION* session) noexcept;
+
+        static int on_new_session(SSL* ssl, SSL_SESSION* session);
+
+    private:
+        SSL_CTX* ctx = nullptr;
+        std::mutex mutex;
+        std::unordered_map<std::string, SSL_SESSION*> sessions;
+    };
+
+    class Tls_Session
+    {
+    public:
+        Tls_Session(Tls_Context& context, int sock, const std::string& host, std::uint16_t port);
+        ~Tls_Session();
+
+        Tls_Session(const Tls_Session&) = delete;
+        Tls_Session& operator=(const Tls_Session&) = delete;
+
+        /* same contract as recv/send: -1 and errno on failure, 0 on close */
+        ssize_t read(char* buff, size_t len) noexcept;
+        ssize_t write(const char* buff, size_t len) noexcept;
+
+        bool resumed() const noexcept;
+        bool kernel_offload() const noexcept;
+
+    private:
+        friend class Tls_Context;
+
+        ssize_t result(int res) noexcept;
+
+    private:
+        Tls_Context& context;
+        std::string key;
+        SSL* ssl = nullptr;
+    };
+}
+
+#endif // TLS_H